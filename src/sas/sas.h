@@ -19,10 +19,13 @@
 #ifndef __SAS_H__
 #define __SAS_H__
 
+#include "sas_accuracy.h"
 #include "sas_envelope.h"
 #include "sas_file.h"
 #include "sas_frame.h"
+#include "sas_hrtf.h"
 #include "sas_synthesizer.h"
 #include "sas_synthesizer_statistics.h"
+#include "sas_trace.h"
 
 #endif
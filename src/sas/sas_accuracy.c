@@ -0,0 +1,170 @@
+/* libsas - library for Structured Additive Synthesis
+   Copyright (C) 1999-2001 Sylvain Marchand
+   Copyright (C) 2001-2002 SCRIME, universit Bordeaux 1
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <math.h>
+#include <float.h>
+#include <assert.h>
+
+#include "sas_accuracy.h"
+
+/* Spectra are compared on the bins where the reference is above this
+   ratio of its peak (-40 dB).  Lower, the bins are dominated by the
+   tolerances of the synthesis on quiet partials (see
+   AMPLITUDE_TOLERANCE in sas_synthesizer.c), masked by the peak. */
+#define SPECTRUM_FLOOR 1e-2
+
+void
+sas_accuracy_reset (sas_accuracy_t a)
+{
+  int i;
+
+  assert (a);
+
+  a->blocks = 0;
+  a->reference_energy = 0.0;
+  a->error_energy = 0.0;
+  a->max_error = 0.0;
+  a->spectral_deviation = 0.0;
+
+  for (i = 0; i < SAS_SAMPLES; i++)
+    {
+      a->window[i] = 0.5 - 0.5 * cos (2.0 * M_PI * i / SAS_SAMPLES);
+      a->cosine[i] = cos (2.0 * M_PI * i / SAS_SAMPLES);
+    }
+}
+
+/* Magnitude spectrum of one channel of a block (SAS_SAMPLES / 2 + 1
+   bins), by direct DFT. */
+static void
+magnitude_spectrum (sas_accuracy_t a, double * block, int channel,
+		    double * spectrum)
+{
+  double x[SAS_SAMPLES];
+  int k;
+  int n;
+
+  for (n = 0; n < SAS_SAMPLES; n++)
+    x[n] = a->window[n] * block[2 * n + channel];
+
+  for (k = 0; k <= SAS_SAMPLES / 2; k++)
+    {
+      double re, im;
+      int j;
+
+      re = 0.0;
+      im = 0.0;
+
+      /* j = k * n modulo SAS_SAMPLES, and sin (x) = cos (x - pi / 2). */
+      for (n = 0, j = 0; n < SAS_SAMPLES; n++, j = (j + k) % SAS_SAMPLES)
+	{
+	  re += x[n] * a->cosine[j];
+	  im -= x[n] * a->cosine[(j + 3 * SAS_SAMPLES / 4) % SAS_SAMPLES];
+	}
+
+      spectrum[k] = sqrt (re * re + im * im);
+    }
+}
+
+static double
+spectral_deviation (sas_accuracy_t a, double * signal, double * reference,
+		    int channel)
+{
+  double s[SAS_SAMPLES / 2 + 1];
+  double r[SAS_SAMPLES / 2 + 1];
+  double peak;
+  double sum;
+  int bins;
+  int k;
+
+  magnitude_spectrum (a, signal, channel, s);
+  magnitude_spectrum (a, reference, channel, r);
+
+  peak = 0.0;
+  for (k = 0; k <= SAS_SAMPLES / 2; k++)
+    if (r[k] > peak)
+      peak = r[k];
+
+  sum = 0.0;
+  bins = 0;
+
+  for (k = 0; k <= SAS_SAMPLES / 2; k++)
+    if (r[k] > SPECTRUM_FLOOR * peak && r[k] > DBL_MIN)
+      {
+	double d;
+
+	d = 20.0 * log10 ((s[k] + DBL_MIN) / r[k]);
+	sum += d * d;
+	bins++;
+      }
+
+  return (bins > 0) ? sqrt (sum / bins) : 0.0;
+}
+
+void
+sas_accuracy_add (sas_accuracy_t a, double * signal, double * reference)
+{
+  double d;
+  int i;
+
+  assert (a);
+  assert (signal);
+  assert (reference);
+
+  for (i = 0; i < 2 * SAS_SAMPLES; i++)
+    {
+      double e;
+
+      e = signal[i] - reference[i];
+      a->reference_energy += reference[i] * reference[i];
+      a->error_energy += e * e;
+      if (fabs (e) > a->max_error)
+	a->max_error = fabs (e);
+    }
+
+  for (i = 0; i < 2; i++)
+    {
+      d = spectral_deviation (a, signal, reference, i);
+      if (d > a->spectral_deviation)
+	a->spectral_deviation = d;
+    }
+
+  a->blocks++;
+}
+
+double
+sas_accuracy_snr (sas_accuracy_t a)
+{
+  assert (a);
+
+  if (a->error_energy == 0.0)
+    return HUGE_VAL;
+
+  return 10.0 * log10 (a->reference_energy / a->error_energy);
+}
+
+int
+sas_accuracy_check (sas_accuracy_t a, sas_accuracy_thresholds_t t)
+{
+  assert (a);
+  assert (t);
+
+  return
+    (sas_accuracy_snr (a) >= t->min_snr) &&
+    (a->max_error <= t->max_error) &&
+    (a->spectral_deviation <= t->max_spectral_deviation);
+}
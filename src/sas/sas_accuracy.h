@@ -0,0 +1,87 @@
+/* libsas - library for Structured Additive Synthesis
+   Copyright (C) 1999-2001 Sylvain Marchand
+   Copyright (C) 2001-2002 SCRIME, universit Bordeaux 1
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __SAS_ACCURACY_H__
+#define __SAS_ACCURACY_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "sas_synthesizer.h"
+
+/* Accuracy measures of a synthesized signal with regard to a
+   reference signal, accumulated over blocks of 2 * SAS_SAMPLES
+   interleaved samples (see sas_synthesizer_synthesize_reference).
+   The fields are public, but should be set by sas_accuracy_reset and
+   sas_accuracy_add only. */
+typedef struct sas_accuracy_s * sas_accuracy_t;
+struct sas_accuracy_s {
+  /* Number of blocks added. */
+  int blocks;
+  /* Energies of the reference and of the error (difference between
+     the signal and the reference). */
+  double reference_energy;
+  double error_energy;
+  /* Largest absolute error of a sample. */
+  double max_error;
+  /* Largest spectral deviation of a block, in dB: root mean square
+     of the differences between the magnitude spectra (Hann window)
+     of the signal and of the reference, over the frequency bins
+     where the reference is above -40 dB of its peak. */
+  double spectral_deviation;
+  /* DFT tables. */
+  double window[SAS_SAMPLES];
+  double cosine[SAS_SAMPLES];
+};
+
+/* Thresholds for sas_accuracy_check. */
+typedef struct sas_accuracy_thresholds_s * sas_accuracy_thresholds_t;
+struct sas_accuracy_thresholds_s {
+  /* Minimal signal to noise ratio (reference to error), in dB. */
+  double min_snr;
+  double max_error;
+  /* Maximal spectral deviation, in dB. */
+  double max_spectral_deviation;
+};
+
+/* Starts measures again. */
+extern void sas_accuracy_reset (sas_accuracy_t a);
+
+/* Adds a block of 'signal' to the measures, given the corresponding
+   block of 'reference'.  Both have 2 * SAS_SAMPLES interleaved
+   samples.  The spectral deviation takes a DFT of each channel,
+   which is slow: this is meant for tests. */
+extern void sas_accuracy_add (sas_accuracy_t a,
+			      double * signal,
+			      double * reference);
+
+/* Returns the signal to noise ratio of the measures, in dB (reference
+   energy to error energy). */
+extern double sas_accuracy_snr (sas_accuracy_t a);
+
+/* Returns 1 if the measures are within the thresholds, 0
+   otherwise. */
+extern int sas_accuracy_check (sas_accuracy_t a,
+			       sas_accuracy_thresholds_t t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
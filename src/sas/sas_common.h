@@ -25,4 +25,92 @@
 #define REPORT(e)
 #endif
 
+/* Storage class of the per-thread state kept by libsas (see the
+   real-time guard).  Without _REENTRANT, there is only one thread
+   anyway. */
+#ifdef _REENTRANT
+#define SAS_THREAD_LOCAL __thread
+#else
+#define SAS_THREAD_LOCAL
+#endif
+
+/* Reference counters of objects that may be shared by the threads of
+   a synthesizer (see sas_synthesizer_set_threads).  Both return the
+   new value. */
+#ifdef _REENTRANT
+#define SAS_ATOMIC_INCREMENT(x) (__sync_add_and_fetch (&(x), 1))
+#define SAS_ATOMIC_DECREMENT(x) (__sync_sub_and_fetch (&(x), 1))
+#else
+#define SAS_ATOMIC_INCREMENT(x) (++(x))
+#define SAS_ATOMIC_DECREMENT(x) (--(x))
+#endif
+
+/* Counters written by one thread and read by another (see the frame
+   queues of sources): the store publishes the writes before it, and
+   the load sees them. */
+#ifdef _REENTRANT
+#define SAS_ATOMIC_LOAD(x) (__atomic_load_n (&(x), __ATOMIC_ACQUIRE))
+#define SAS_ATOMIC_STORE(x,v) (__atomic_store_n (&(x), (v), __ATOMIC_RELEASE))
+#else
+#define SAS_ATOMIC_LOAD(x) (x)
+#define SAS_ATOMIC_STORE(x,v) ((x) = (v))
+#endif
+
+/* Flags guarding the free lists shared by all the threads (see the
+   envelope and frame pools).  A thread never waits for a flag:
+   SAS_TRY_LOCK returns 0 if another thread holds it, and the caller
+   does without the free list. */
+#ifdef _REENTRANT
+#define SAS_TRY_LOCK(flag) (__sync_lock_test_and_set (&(flag), 1) == 0)
+#define SAS_UNLOCK(flag) (__sync_lock_release (&(flag)))
+#else
+#define SAS_TRY_LOCK(flag) ((void) (flag), 1)
+#define SAS_UNLOCK(flag)
+#endif
+
+/* Real-time guard, for debugging: compiled with SAS_RT_GUARD, libsas
+   marks the places where it may allocate memory, take a lock, block
+   in a system call or exit.  Reached from a synthesizer in the middle
+   of a block (see sas_synthesizer_synthesize), including from the
+   update callbacks of its sources, they are counted in its
+   statistics, and each place is reported on stderr the first time. */
+#define SAS_RT_ALLOCATION 0
+#define SAS_RT_LOCK 1
+#define SAS_RT_SYSCALL 2
+#define SAS_RT_EXIT 3
+#define SAS_RT_EVENTS 4
+
+#ifdef SAS_RT_GUARD
+extern void sas_rt_event (int event, const char * where, int * reported);
+#define SAS_RT_EVENT(event)					\
+  do								\
+    {								\
+      static int sas_rt_reported = 0;				\
+      sas_rt_event ((event), __FUNCTION__, &sas_rt_reported);	\
+    }								\
+  while (0)
+#else
+#define SAS_RT_EVENT(event)
+#endif
+
+/* Pseudo-random numbers of the synthesizers (xorshift on 32 bits):
+   each user keeps its own state, so that the sequence only depends
+   on the seed, without locks.  The state must not be 0.  Returns a
+   number between 1 and SAS_RANDOM_MAX. */
+#define SAS_RANDOM_MAX 0xffffffffUL
+
+static inline unsigned long
+sas_random (unsigned long * state)
+{
+  unsigned long x;
+
+  x = *state;
+  x ^= (x << 13) & SAS_RANDOM_MAX;
+  x ^= x >> 17;
+  x ^= (x << 5) & SAS_RANDOM_MAX;
+  *state = x;
+
+  return x;
+}
+
 #endif
@@ -21,6 +21,10 @@
 #include <math.h>
 #include <assert.h>
 
+#ifdef _REENTRANT
+#include <pthread.h>
+#endif
+
 #include "sas_common.h"
 #include "sas_envelope.h"
 #include "sas_synthesizer.h"
@@ -30,30 +34,104 @@
    only. */
 #include "sas_envelope_private.c"
 
+/* The pool of envelopes.  Deleted envelopes are not given back to
+   malloc but kept in free lists, sorted by size classes: class c
+   holds envelopes whose data can store (1 << (c +
+   POOL_MIN_SHIFT)) values, including the four interpolation values.
+   Envelopes made by file playback and morphing have only a few
+   different sizes, so that steady-state synthesis does not allocate
+   memory at all. */
+#define POOL_MIN_SHIFT 3
+#define POOL_CLASSES 10
+/* Bound on the number of free envelopes in each class. */
+#define POOL_MAX_FREE 64
+
+struct pool_class_s {
+  sas_envelope_t free;
+  int count;
+  /* Held while a thread pops or pushes (see SAS_TRY_LOCK). */
+  int busy;
+};
+
+/* One pool shared by all the threads, so that an envelope deleted by
+   a worker of a synthesizer returns to the thread that makes
+   envelopes, and that no free list is left behind by an exiting
+   thread.  The critical sections are a few instructions long: when a
+   class is busy, the thread just allocates or frees the envelope
+   itself. */
+static struct pool_class_s pool[POOL_CLASSES];
+
+/* Standard envelopes, shared by all frames and synthesizers.  They
+   are made once, and are locked so that their reference counters are
+   never modified (see sas_envelope_keep and sas_envelope_free): this
+   way, they can be used from several threads without any lock. */
 static sas_envelope_t color_0 = NULL;
 static sas_envelope_t warp_identity = NULL;
 static sas_envelope_t amplitude_threshold = NULL;
 
+#ifdef _REENTRANT
+static pthread_once_t standard_envelopes_once = PTHREAD_ONCE_INIT;
+#endif
+
+/* Returns the size class of envelopes of #size points.  Classes above
+   POOL_CLASSES - 1 are not pooled. */
+static inline int
+pool_class (int size)
+{
+  int c;
+
+  c = 0;
+  while ((1 << (c + POOL_MIN_SHIFT)) < 2 + size + 2)
+    c++;
+
+  return c;
+}
+
 sas_envelope_t
 sas_envelope_make (double base, int size, double * values)
 {
   sas_envelope_t e;
+  int c;
   int i;
 
-  /* Maybe we should keep a pool of envelopes, so that malloc is
-     called less often.  Anyway, GNU libc's malloc already does a very
-     good job on that. */
-  e = (sas_envelope_t) malloc (sizeof (struct sas_envelope_s));
-  assert (e);
+  c = pool_class (size);
+  e = NULL;
+
+  if (c < POOL_CLASSES && SAS_TRY_LOCK (pool[c].busy))
+    {
+      e = pool[c].free;
+      if (e != NULL)
+	{
+	  pool[c].free = e->next;
+	  pool[c].count--;
+	}
+      SAS_UNLOCK (pool[c].busy);
+    }
+
+  if (e == NULL)
+    {
+      SAS_RT_EVENT (SAS_RT_ALLOCATION);
+      e = (sas_envelope_t) malloc (sizeof (struct sas_envelope_s));
+      assert (e);
+
+      /* For interpolation purposes, data keeps two values on both
+	 sides.  Pooled envelopes get the whole room of their class,
+	 so that they can be recycled for any size of the class. */
+      e->data = (double *)
+	malloc (((c < POOL_CLASSES) ?
+		 (1 << (c + POOL_MIN_SHIFT)) :
+		 2 + size + 2) * sizeof (double));
+      assert (e->data);
+      e->data += 2;
+    }
 
   e->base = base;
   e->size = size;
-  /* For interpolation purposes, data keeps two values on both sides. */
-  e->data = (double *) calloc (2 + e->size + 2, sizeof (double));
-  assert (e->data);
-  e->data += 2;
+  e->data[-2] = e->data[-1] = 0.0;
   for (i = 0; i < e->size; i++)
     e->data[i] = values[i];
+  e->data[e->size] = e->data[e->size + 1] = 0.0;
+  e->next = NULL;
 
   /* The envelope is eligible for deletion, unless it is stored in a
      frame, which will result in incrementing refcount. */
@@ -67,7 +145,13 @@ void
 sas_envelope_keep (sas_envelope_t e)
 {
   assert (e);
-  e->refcount++;
+
+  /* Locked envelopes are never deleted, so don't count references
+     (they may be shared across threads). */
+  if (e->lock)
+    return;
+
+  SAS_ATOMIC_INCREMENT (e->refcount);
 
   REPORT (fprintf (stderr,
 		   "keeping envelope %p (refcount: %u)\n",
@@ -79,13 +163,38 @@ sas_envelope_free (sas_envelope_t e)
 {
   assert (e);
 
-  e->refcount--;
-  if (e->refcount <= 0 && !e->lock)
+  if (e->lock)
+    return;
+
+  if (SAS_ATOMIC_DECREMENT (e->refcount) == 0)
     {
-      REPORT (fprintf (stderr, "deleting envelope %p from memory\n", e));
-      e->data -= 2;
-      free (e->data);
-      free (e);
+      int recycled;
+      int c;
+
+      c = pool_class (e->size);
+      recycled = 0;
+
+      if (c < POOL_CLASSES && SAS_TRY_LOCK (pool[c].busy))
+	{
+	  if (pool[c].count < POOL_MAX_FREE)
+	    {
+	      REPORT (fprintf (stderr, "recycling envelope %p\n", e));
+	      e->next = pool[c].free;
+	      pool[c].free = e;
+	      pool[c].count++;
+	      recycled = 1;
+	    }
+	  SAS_UNLOCK (pool[c].busy);
+	}
+
+      if (!recycled)
+	{
+	  REPORT (fprintf (stderr, "deleting envelope %p from memory\n", e));
+	  SAS_RT_EVENT (SAS_RT_ALLOCATION);
+	  e->data -= 2;
+	  free (e->data);
+	  free (e);
+	}
     }
   else
     REPORT (fprintf (stderr,
@@ -131,13 +240,13 @@ sas_envelope_get_value (sas_envelope_t e, double frequency)
   return sas_envelope_get_value_inline (e, frequency);
 }
 
-sas_envelope_t
-sas_envelope_color_0 (void)
+/* Makes the standard envelopes.  Called only once (see
+   make_standard_envelopes_once). */
+static void
+make_standard_envelopes (void)
 {
-  double values[1];
-
-  if (color_0)
-    return color_0;
+  int i;
+  double values[SAS_ENVELOPE_STDSIZE];
 
   values[0] = 0.0;
 
@@ -146,17 +255,6 @@ sas_envelope_color_0 (void)
   color_0->lock = 1;
   sas_envelope_adjust_for_color (color_0);
 
-  return color_0;
-}
-
-sas_envelope_t
-sas_envelope_warp_identity (void)
-{
-  double values[1];
-
-  if (warp_identity)
-    return warp_identity;
-
   values[0] = SAS_MAX_AUDIBLE_FREQUENCY;
 
   warp_identity =
@@ -164,18 +262,6 @@ sas_envelope_warp_identity (void)
   warp_identity->lock = 1;
   sas_envelope_adjust_for_warp (warp_identity);
 
-  return warp_identity;
-}
-
-sas_envelope_t
-sas_envelope_amplitude_threshold (void)
-{
-  int i;
-  double values[SAS_ENVELOPE_STDSIZE];
-
-  if (amplitude_threshold)
-    return amplitude_threshold;
-
   for (i = 0; i < SAS_ENVELOPE_STDSIZE; i++)
     {
       double f;
@@ -200,7 +286,37 @@ sas_envelope_amplitude_threshold (void)
 
   /* Warp-like interpolation on both sides of the envelope. */
   sas_envelope_adjust_for_warp (amplitude_threshold);
+}
 
+static inline void
+make_standard_envelopes_once (void)
+{
+#ifdef _REENTRANT
+  pthread_once (&standard_envelopes_once, make_standard_envelopes);
+#else
+  if (color_0 == NULL)
+    make_standard_envelopes ();
+#endif
+}
+
+sas_envelope_t
+sas_envelope_color_0 (void)
+{
+  make_standard_envelopes_once ();
+  return color_0;
+}
+
+sas_envelope_t
+sas_envelope_warp_identity (void)
+{
+  make_standard_envelopes_once ();
+  return warp_identity;
+}
+
+sas_envelope_t
+sas_envelope_amplitude_threshold (void)
+{
+  make_standard_envelopes_once ();
   return amplitude_threshold;
 }
 
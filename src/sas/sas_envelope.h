@@ -42,8 +42,9 @@ extern sas_envelope_t sas_envelope_make (double base,
 extern void sas_envelope_keep (sas_envelope_t e);
 
 /* Decrements the reference counter of an envelope, and eventually
-   deletes the envelope from memory.  Call this function when an
-   envelope is no more needed in a SAS frame. */
+   deletes the envelope.  Call this function when an envelope is no
+   more needed in a SAS frame.  The memory of deleted envelopes is
+   kept in a pool, and reused by next calls to sas_envelope_make. */
 extern void sas_envelope_free (sas_envelope_t e);
 
 /* Color envelopes should be adjusted when created, such that
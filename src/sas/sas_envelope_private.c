@@ -36,6 +36,9 @@ struct sas_envelope_s {
   unsigned int refcount;
   /* 0 if the envelope can be deleted, 1 otherwise. */
   int lock;
+
+  /* Next envelope in a free list of the envelope pool. */
+  struct sas_envelope_s * next;
 };
 
 /* This function has some cost and is called many times in several
@@ -0,0 +1,87 @@
+/* libsas - library for Structured Additive Synthesis
+   Copyright (C) 1999-2001 Sylvain Marchand
+   Copyright (C) 2001-2002 SCRIME, universit Bordeaux 1
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+
+#include <math.h>
+#include <assert.h>
+
+#include "sas_fft.h"
+
+/* Radix-2, decimation in time.  The twiddle factors of a stage are
+   computed by recurrence, which is accurate enough for the sizes
+   used in libsas (a few thousand points at most). */
+void
+sas_fft (double * re, double * im, int n, int sign)
+{
+  int i, j, k;
+  int m;
+
+  assert (re);
+  assert (im);
+  assert (n > 0 && (n & (n - 1)) == 0);
+
+  /* Bit reversal permutation. */
+  for (i = 0, j = 0; i < n; i++)
+    {
+      if (i < j)
+	{
+	  double t;
+
+	  t = re[i]; re[i] = re[j]; re[j] = t;
+	  t = im[i]; im[i] = im[j]; im[j] = t;
+	}
+
+      for (k = n >> 1; k > 0 && (j & k); k >>= 1)
+	j ^= k;
+      j |= k;
+    }
+
+  /* Butterflies. */
+  for (m = 1; m < n; m <<= 1)
+    {
+      double wr, wi;
+      double dr, di;
+
+      dr = cos (M_PI / m);
+      di = sign * sin (M_PI / m);
+      wr = 1.0;
+      wi = 0.0;
+
+      for (k = 0; k < m; k++)
+	{
+	  double t;
+
+	  for (i = k; i < n; i += 2 * m)
+	    {
+	      double tr, ti;
+
+	      j = i + m;
+	      tr = wr * re[j] - wi * im[j];
+	      ti = wr * im[j] + wi * re[j];
+	      re[j] = re[i] - tr;
+	      im[j] = im[i] - ti;
+	      re[i] += tr;
+	      im[i] += ti;
+	    }
+
+	  t = wr;
+	  wr = wr * dr - wi * di;
+	  wi = t * di + wi * dr;
+	}
+    }
+}
@@ -0,0 +1,37 @@
+/* libsas - library for Structured Additive Synthesis
+   Copyright (C) 1999-2001 Sylvain Marchand
+   Copyright (C) 2001-2002 SCRIME, universit Bordeaux 1
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+
+#ifndef __SAS_FFT_H__
+#define __SAS_FFT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* In-place fast Fourier transform of the 'n' complex values ('re[i]',
+   'im[i]'), where 'n' is a power of 2.  'sign' is -1 for the direct
+   transform and 1 for the inverse one, which is not divided by
+   'n'. */
+extern void sas_fft (double * re, double * im, int n, int sign);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
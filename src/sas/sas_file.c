@@ -93,6 +93,7 @@ sas_file_open (const char * filename)
 
 #ifdef _REENTRANT
   int error;
+  SAS_RT_EVENT (SAS_RT_LOCK);
   error = pthread_mutex_lock (&file_cache->lock);
   assert (error != EDEADLK);
 #endif
@@ -130,6 +131,7 @@ sas_file_open (const char * filename)
     }
   cell->format = sas_file_formats[format];
 
+  SAS_RT_EVENT (SAS_RT_SYSCALL);
   cell->f = cell->format->open (filename);
   if (!cell->f)
     {
@@ -165,6 +167,7 @@ sas_file_close (sas_file_t f)
 
 #ifdef _REENTRANT
   int error;
+  SAS_RT_EVENT (SAS_RT_LOCK);
   error = pthread_mutex_lock (&file_cache->lock);
   assert (error != EDEADLK);
 #endif
@@ -220,6 +223,7 @@ sas_file_number_of_frames (sas_file_t f)
 
 #ifdef _REENTRANT
   int error;
+  SAS_RT_EVENT (SAS_RT_LOCK);
   error = pthread_mutex_lock (&file_cache->lock);
   assert (error != EDEADLK);
 #endif
@@ -259,6 +263,7 @@ sas_file_get_frame (sas_file_t f, sas_frame_t dest, int n)
 
 #ifdef _REENTRANT
   int error;
+  SAS_RT_EVENT (SAS_RT_LOCK);
   error = pthread_mutex_lock (&file_cache->lock);
   assert (error != EDEADLK);
 #endif
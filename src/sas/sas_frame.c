@@ -20,6 +20,7 @@
 #include <math.h>
 #include <assert.h>
 
+#include "sas_common.h"
 #include "sas_frame.h"
 #include "sas_envelope.h"
 #include "sas_synthesizer.h"
@@ -31,21 +32,65 @@ struct sas_frame_s {
   double frequency;
   sas_envelope_t color;
   sas_envelope_t warp;
+  /* Amplitudes of the noise with regard to frequency (see
+     sas_frame_set_noise), constant color 0 for no noise. */
+  sas_envelope_t noise;
+  /* Next frame in the free list of the frame pool. */
+  sas_frame_t next;
 };
 
+/* The pool of frames.  Deleted frames are kept in a free list
+   shared by all the threads (see the envelope pool) instead of being
+   given back to malloc, up to POOL_MAX_FREE frames.  A source of a
+   synthesizer holds a few hundred frames, so that this is enough to
+   recycle the frames of a deleted source. */
+#define POOL_MAX_FREE 1024
+
+static sas_frame_t pool = NULL;
+static int pool_count = 0;
+/* Held while a thread pops or pushes (see SAS_TRY_LOCK). */
+static int pool_busy = 0;
+
+size_t
+sas_frame_size (void)
+{
+  return sizeof (struct sas_frame_s);
+}
+
 sas_frame_t
 sas_frame_make (void)
 {
   sas_frame_t f;
 
-  f = (sas_frame_t) malloc (sizeof (struct sas_frame_s));
-  assert (f);
+  f = NULL;
+
+  if (SAS_TRY_LOCK (pool_busy))
+    {
+      f = pool;
+      if (f != NULL)
+	{
+	  pool = f->next;
+	  pool_count--;
+	}
+      SAS_UNLOCK (pool_busy);
+    }
+
+  if (f == NULL)
+    {
+      SAS_RT_EVENT (SAS_RT_ALLOCATION);
+      f = (sas_frame_t) malloc (sizeof (struct sas_frame_s));
+      assert (f);
+    }
+
+  f->next = NULL;
   f->amplitude = 0.0;
   f->frequency = 440.0;
   f->color = sas_envelope_color_0 ();
   sas_envelope_keep (f->color);
   f->warp = sas_envelope_warp_identity ();
   sas_envelope_keep (f->warp);
+  f->noise = sas_envelope_color_0 ();
+  sas_envelope_keep (f->noise);
 
   return f;
 }
@@ -56,7 +101,25 @@ sas_frame_free (sas_frame_t f)
   assert (f);
   sas_envelope_free (f->color);
   sas_envelope_free (f->warp);
-  free (f);
+  sas_envelope_free (f->noise);
+
+  if (SAS_TRY_LOCK (pool_busy))
+    {
+      if (pool_count < POOL_MAX_FREE)
+	{
+	  f->next = pool;
+	  pool = f;
+	  pool_count++;
+	  f = NULL;
+	}
+      SAS_UNLOCK (pool_busy);
+    }
+
+  if (f != NULL)
+    {
+      SAS_RT_EVENT (SAS_RT_ALLOCATION);
+      free (f);
+    }
 }
 
 void
@@ -69,6 +132,7 @@ sas_frame_copy (sas_frame_t dest, sas_frame_t f)
   dest->frequency = f->frequency;
   sas_frame_set_color (dest, sas_frame_get_color (f));
   sas_frame_set_warp (dest, sas_frame_get_warp (f));
+  sas_frame_set_noise (dest, sas_frame_get_noise (f));
 }
 
 void
@@ -138,6 +202,25 @@ sas_frame_get_warp (sas_frame_t f)
   return f->warp;
 }
 
+void
+sas_frame_set_noise (sas_frame_t f, sas_envelope_t e)
+{
+  assert (f);
+  if (f->noise != e)
+    {
+      sas_envelope_free (f->noise);
+      sas_envelope_keep (e);
+      f->noise = e;
+    }
+}
+
+sas_envelope_t
+sas_frame_get_noise (sas_frame_t f)
+{
+  assert (f);
+  return f->noise;
+}
+
 /* a and b should be positive or null for the following formula to
    work. */
 #define MORPH(a,b,x) (pow ((a), 1.0 - (x)) * pow ((b), (x)))
@@ -154,8 +237,11 @@ sas_frame_morphing (sas_frame_t dest,
 {
   double cvalues[SAS_ENVELOPE_STDSIZE];
   double wvalues[SAS_ENVELOPE_STDSIZE];
+  double nvalues[SAS_ENVELOPE_STDSIZE];
   sas_envelope_t C, C1, C2;
   sas_envelope_t W, W1, W2;
+  sas_envelope_t N, N1, N2;
+  int noise;
   int i;
 
   assert (dest);
@@ -170,6 +256,11 @@ sas_frame_morphing (sas_frame_t dest,
   W1 = sas_frame_get_warp (f1);
   C2 = sas_frame_get_color (f2);
   W2 = sas_frame_get_warp (f2);
+  N1 = sas_frame_get_noise (f1);
+  N2 = sas_frame_get_noise (f2);
+
+  /* Frames without noise morph into a frame without noise. */
+  noise = (N1 != sas_envelope_color_0 ()) || (N2 != sas_envelope_color_0 ());
 
   for (i = 0; i < SAS_ENVELOPE_STDSIZE; i++)
     {
@@ -184,6 +275,11 @@ sas_frame_morphing (sas_frame_t dest,
       wvalues[i] = MORPH (sas_envelope_get_value_inline (W1, frequency),
 			  sas_envelope_get_value_inline (W2, frequency),
 			  coeff);
+
+      if (noise)
+	nvalues[i] = MORPH (sas_envelope_get_value_inline (N1, frequency),
+			    sas_envelope_get_value_inline (N2, frequency),
+			    coeff);
     }
 
   C = sas_envelope_make (SAS_ENVELOPE_STDBASE, SAS_ENVELOPE_STDSIZE, cvalues);
@@ -192,13 +288,25 @@ sas_frame_morphing (sas_frame_t dest,
   sas_envelope_adjust_for_warp (W);
   sas_frame_set_color (dest, C);
   sas_frame_set_warp (dest, W);
+
+  if (noise)
+    {
+      N = sas_envelope_make (SAS_ENVELOPE_STDBASE, SAS_ENVELOPE_STDSIZE,
+			     nvalues);
+      sas_envelope_adjust_for_color (N);
+    }
+  else
+    N = sas_envelope_color_0 ();
+  sas_frame_set_noise (dest, N);
 }
 
 void
 sas_frame_filter (sas_frame_t dest, sas_frame_t f, sas_frame_t filter)
 {
   double cvalues[SAS_ENVELOPE_STDSIZE];
+  double nvalues[SAS_ENVELOPE_STDSIZE];
   sas_envelope_t C, Cf, Cfilter;
+  sas_envelope_t N, Nf;
   int i;
 
   assert (dest);
@@ -210,6 +318,7 @@ sas_frame_filter (sas_frame_t dest, sas_frame_t f, sas_frame_t filter)
 
   Cf = sas_frame_get_color (f);
   Cfilter = sas_frame_get_color (filter);
+  Nf = sas_frame_get_noise (f);
 
   for (i = 0; i < SAS_ENVELOPE_STDSIZE; i++)
     {
@@ -219,6 +328,11 @@ sas_frame_filter (sas_frame_t dest, sas_frame_t f, sas_frame_t filter)
 
       cvalues[i] = sas_envelope_get_value_inline (Cf, frequency) *
 	sas_envelope_get_value_inline (Cfilter, frequency);
+
+      /* The noise goes through the filter too. */
+      if (Nf != sas_envelope_color_0 ())
+	nvalues[i] = sas_envelope_get_value_inline (Nf, frequency) *
+	  sas_envelope_get_value_inline (Cfilter, frequency);
     }
 
   C = sas_envelope_make (SAS_ENVELOPE_STDBASE, SAS_ENVELOPE_STDSIZE, cvalues);
@@ -226,5 +340,15 @@ sas_frame_filter (sas_frame_t dest, sas_frame_t f, sas_frame_t filter)
   sas_frame_set_color (dest, C);
 
   sas_frame_set_warp (dest, sas_frame_get_warp (f));
+
+  if (Nf != sas_envelope_color_0 ())
+    {
+      N = sas_envelope_make (SAS_ENVELOPE_STDBASE, SAS_ENVELOPE_STDSIZE,
+			     nvalues);
+      sas_envelope_adjust_for_color (N);
+    }
+  else
+    N = Nf;
+  sas_frame_set_noise (dest, N);
 }
 
@@ -26,16 +26,25 @@ extern "C" {
 /* Abstract data type for SAS frames. */
 typedef struct sas_frame_s * sas_frame_t;
 
+#include <stddef.h>
+
 #include "sas_envelope.h"
 
 /* Returns a newly allocated SAS frame with amplitude 0,
-   frequency 440, constant color 0 and identity warp. */
+   frequency 440, constant color 0, identity warp and no noise. */
 extern sas_frame_t sas_frame_make (void);
 
+/* Returns the size in bytes of the memory used by a SAS frame, not
+   counting its envelopes. */
+extern size_t sas_frame_size (void);
+
+/* Deletes a SAS frame, freeing its envelopes (see
+   'sas_envelope_free').  The memory of the frame is kept in a pool,
+   and reused by next calls to sas_frame_make. */
 extern void sas_frame_free (sas_frame_t f);
 
 /* Copies amplitude and frequency of 'f' into 'dest', and share the
-   color and warp envelopes of 'f' with 'dest'.  Previous envelopes of
+   color, warp and noise envelopes of 'f' with 'dest'.  Previous envelopes of
    'dest' are freed (see 'sas_envelope_free'). */
 extern inline void sas_frame_copy (sas_frame_t dest,
 				   sas_frame_t f);
@@ -68,6 +77,20 @@ extern void sas_frame_set_warp (sas_frame_t f,
 
 extern inline sas_envelope_t sas_frame_get_warp (sas_frame_t f);
 
+/* Replaces the noise envelope of 'f' by 'noise'.  Previous noise
+   envelope of 'f' is freed (see 'sas_envelope_free').  Besides its
+   harmonics, a frame is heard with a filtered noise, whose amplitude
+   at each frequency is the value of the noise envelope times the
+   amplitude of the frame: a noise envelope of constant value 1 gives
+   a white noise of the same power as a sinusoid of the amplitude of
+   the frame.  The constant color 0 (see sas_envelope_color_0), the
+   default, stands for no noise, which costs nothing at synthesis
+   time. */
+extern void sas_frame_set_noise (sas_frame_t f,
+				 sas_envelope_t noise);
+
+extern inline sas_envelope_t sas_frame_get_noise (sas_frame_t f);
+
 /* Fills 'dest' with the result of morphing 'f1' and 'f2' by
    coefficient 'coeff'.  The coefficient should be a number between 0
    (in which case the morphing results in 'f1') and 1 (in which case
@@ -77,7 +100,9 @@ extern void sas_frame_morphing (sas_frame_t dest,
 				sas_frame_t f2,
 				double coeff);
 
-/* Fills 'dest' with the result of 'f' filtered by 'filter'. */
+/* Fills 'dest' with the result of 'f' filtered by 'filter'.  The
+   color of 'filter' applies to both the color and the noise of
+   'f'. */
 extern void sas_frame_filter (sas_frame_t dest,
 			      sas_frame_t f,
 			      sas_frame_t filter);
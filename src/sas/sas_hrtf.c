@@ -0,0 +1,228 @@
+/* libsas - library for Structured Additive Synthesis
+   Copyright (C) 1999-2001 Sylvain Marchand
+   Copyright (C) 2001-2002 SCRIME, universit Bordeaux 1
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+
+#include "fileio.h"
+#include "ieeefloat.h"
+#include "sas_common.h"
+#include "sas_hrtf.h"
+
+#define HRTF_VERSION 1
+
+struct sas_hrtf_s {
+  int azimuths;
+  int elevations;
+  int bands;
+  double lowest_elevation;
+  double highest_elevation;
+  double band_width;
+  /* The responses of the directions, elevation by elevation: for
+     each one, the ITD followed by the left and right magnitudes (see
+     RESPONSE_SIZE). */
+  double * responses;
+};
+
+#define RESPONSE_SIZE(h) (1 + 2 * (h)->bands)
+
+static inline int
+read_double (FILE * fp, double * value)
+{
+  char data[kDoubleLength];
+
+  if (!IO_Read_Str (data, kDoubleLength, fp))
+    return 0;
+
+  *value = ConvertFromIeeeDouble (data);
+  return 1;
+}
+
+sas_hrtf_t
+sas_hrtf_load (const char * filename)
+{
+  FILE * fp;
+  ULONG id;
+  LONG version;
+  LONG azimuths, elevations, bands;
+  sas_hrtf_t h;
+  int n;
+  int i;
+
+  assert (filename);
+
+  fp = fopen (filename, "rb");
+  if (!fp)
+    {
+      REPORT (perror ("sas_hrtf_load: fopen failed"));
+      return NULL;
+    }
+
+  if ((!IO_Read_BE_ULONG (&id, fp)) ||
+      (id != MakeID ('S', 'A', 'S', 'H')) ||
+      (!IO_Read_BE_LONG (&version, fp)) ||
+      (version != HRTF_VERSION) ||
+      (!IO_Read_BE_LONG (&azimuths, fp)) ||
+      (!IO_Read_BE_LONG (&elevations, fp)) ||
+      (!IO_Read_BE_LONG (&bands, fp)) ||
+      (azimuths < 1) || (elevations < 1) || (bands < 1))
+    {
+      REPORT (fprintf (stderr, "sas_hrtf_load: bad header.\n"));
+      fclose (fp);
+      return NULL;
+    }
+
+  h = (sas_hrtf_t) malloc (sizeof (struct sas_hrtf_s));
+  assert (h);
+
+  h->azimuths = azimuths;
+  h->elevations = elevations;
+  h->bands = bands;
+
+  n = azimuths * elevations * RESPONSE_SIZE (h);
+  h->responses = (double *) malloc (n * sizeof (double));
+  assert (h->responses);
+
+  if ((!read_double (fp, &h->lowest_elevation)) ||
+      (!read_double (fp, &h->highest_elevation)) ||
+      (!read_double (fp, &h->band_width)) ||
+      (h->highest_elevation < h->lowest_elevation) ||
+      (h->band_width <= 0.0))
+    {
+      REPORT (fprintf (stderr, "sas_hrtf_load: bad header.\n"));
+      sas_hrtf_free (h);
+      fclose (fp);
+      return NULL;
+    }
+
+  for (i = 0; i < n; i++)
+    if (!read_double (fp, h->responses + i))
+      {
+	REPORT (fprintf (stderr, "sas_hrtf_load: truncated file.\n"));
+	sas_hrtf_free (h);
+	fclose (fp);
+	return NULL;
+      }
+
+  fclose (fp);
+
+  return h;
+}
+
+void
+sas_hrtf_free (sas_hrtf_t h)
+{
+  assert (h);
+
+  free (h->responses);
+  free (h);
+}
+
+void
+sas_hrtf_direction (sas_hrtf_t h,
+		    double azimuth,
+		    double elevation,
+		    sas_hrtf_direction_t d)
+{
+  double a, e;
+  int a0, a1, e0, e1;
+  int k;
+
+  assert (h);
+  assert (d);
+
+  /* Azimuths wrap around. */
+  a = azimuth * h->azimuths / 360.0;
+  a -= h->azimuths * floor (a / h->azimuths);
+  a0 = (int) a;
+  if (a0 >= h->azimuths)
+    a0 = 0;
+  a1 = (a0 + 1 == h->azimuths) ? 0 : a0 + 1;
+  a -= floor (a);
+
+  /* Elevations beyond the grid get the nearest one. */
+  if (h->elevations == 1 || elevation <= h->lowest_elevation)
+    e = 0.0;
+  else if (elevation >= h->highest_elevation)
+    e = h->elevations - 1;
+  else
+    e = (elevation - h->lowest_elevation) * (h->elevations - 1) /
+      (h->highest_elevation - h->lowest_elevation);
+  e0 = (int) e;
+  e1 = (e0 + 1 < h->elevations) ? e0 + 1 : e0;
+  e -= e0;
+
+  d->hrtf = h;
+
+  d->responses[0] = h->responses +
+    (e0 * h->azimuths + a0) * RESPONSE_SIZE (h);
+  d->responses[1] = h->responses +
+    (e0 * h->azimuths + a1) * RESPONSE_SIZE (h);
+  d->responses[2] = h->responses +
+    (e1 * h->azimuths + a0) * RESPONSE_SIZE (h);
+  d->responses[3] = h->responses +
+    (e1 * h->azimuths + a1) * RESPONSE_SIZE (h);
+
+  d->weights[0] = (1.0 - e) * (1.0 - a);
+  d->weights[1] = (1.0 - e) * a;
+  d->weights[2] = e * (1.0 - a);
+  d->weights[3] = e * a;
+
+  d->itd = 0.0;
+  for (k = 0; k < 4; k++)
+    d->itd += d->weights[k] * d->responses[k][0];
+}
+
+void
+sas_hrtf_gains (sas_hrtf_direction_t d,
+		double frequency,
+		double * left,
+		double * right)
+{
+  sas_hrtf_t h;
+  double b;
+  int b0, b1;
+  int k;
+
+  h = d->hrtf;
+
+  b = frequency / h->band_width;
+  if (b <= 0.0)
+    b = 0.0;
+  else if (b >= h->bands - 1)
+    b = h->bands - 1;
+  b0 = (int) b;
+  b1 = (b0 + 1 < h->bands) ? b0 + 1 : b0;
+  b -= b0;
+
+  *left = 0.0;
+  *right = 0.0;
+
+  for (k = 0; k < 4; k++)
+    {
+      const double * r;
+
+      r = d->responses[k];
+      *left += d->weights[k] *
+	((1.0 - b) * r[1 + b0] + b * r[1 + b1]);
+      *right += d->weights[k] *
+	((1.0 - b) * r[1 + h->bands + b0] + b * r[1 + h->bands + b1]);
+    }
+}
@@ -0,0 +1,90 @@
+/* libsas - library for Structured Additive Synthesis
+   Copyright (C) 1999-2001 Sylvain Marchand
+   Copyright (C) 2001-2002 SCRIME, universit Bordeaux 1
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __SAS_HRTF_H__
+#define __SAS_HRTF_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Abstract data type for HRTF sets, that is the magnitude responses
+   of the left and right ears and the interaural time difference
+   (ITD) for a grid of directions around the listener.  A synthesizer
+   given an HRTF set (see sas_synthesizer_set_hrtf) renders its
+   sources binaurally.
+
+   Directions are given by azimuth and elevation, in degrees, with
+   regard to the listener: azimuth 0 is straight ahead (positive y),
+   azimuth 90 is on the right (positive x), and elevation 90 is
+   above (positive z).
+
+   HRTF files are binary, big-endian like traces (see sas_trace.h):
+   the 'SASH' identifier and the version of the format, then
+
+     azimuths elevations bands                            (LONGs)
+     lowest_elevation highest_elevation band_width        (doubles)
+
+   and, for each elevation from the lowest to the highest, for each
+   azimuth from 0 by steps of 360 / azimuths degrees,
+
+     itd left[0] .. left[bands - 1] right[0] .. right[bands - 1]
+                                                          (doubles)
+
+   The elevations are evenly spaced, the ITD is the delay of the left
+   ear with regard to the right one in seconds, and left[k] and
+   right[k] are the magnitudes of the responses at k * band_width Hz.
+   Magnitudes of 1 at both ears give the level of a source straight
+   ahead without HRTF set. */
+typedef struct sas_hrtf_s * sas_hrtf_t;
+
+/* Loads an HRTF set from a file.  Returns NULL on failure. */
+extern sas_hrtf_t sas_hrtf_load (const char * filename);
+
+/* Deletes an HRTF set.  It should not be used by a synthesizer
+   anymore. */
+extern void sas_hrtf_free (sas_hrtf_t h);
+
+/* The responses of an HRTF set in one direction, interpolated from
+   the four directions of the grid around it.  Used by the
+   synthesizer, once per source and per block. */
+typedef struct sas_hrtf_direction_s * sas_hrtf_direction_t;
+struct sas_hrtf_direction_s {
+  sas_hrtf_t hrtf;
+  const double * responses[4];
+  double weights[4];
+  double itd;
+};
+
+extern void sas_hrtf_direction (sas_hrtf_t h,
+				double azimuth,
+				double elevation,
+				sas_hrtf_direction_t d);
+
+/* Sets 'left' and 'right' to the magnitudes of the responses of a
+   direction at 'frequency' Hz, interpolated between bands. */
+extern void sas_hrtf_gains (sas_hrtf_direction_t d,
+			    double frequency,
+			    double * left,
+			    double * right);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
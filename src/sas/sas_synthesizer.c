@@ -20,11 +20,19 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <math.h>
+#include <sys/time.h>
+#ifdef _REENTRANT
+#include <pthread.h>
+#endif
 
+#include "sas_common.h"
 #include "sas_synthesizer.h"
 #include "sas_envelope.h"
 #include "sas_frame.h"
 #include "sas_synthesizer_statistics.h"
+#include "sas_trace.h"
+#include "sas_fft.h"
+#include "sas_hrtf.h"
 
 #include "sas_envelope_private.c"
 
@@ -43,11 +51,35 @@
 #define DISTANCE(x,y,z) (sqrt (SQR (x) + SQR (y) + SQR (z)))
 
 #define MAX_PARTIALS_PER_SOURCE 1024
+/* Number of partials first allocated for a source.  More are
+   allocated when needed, between blocks (see grow_sources), up to
+   MAX_PARTIALS_PER_SOURCE. */
+#define MIN_PARTIALS_PER_SOURCE 8
 #define MAX_PARTIALS_PER_SYNTH MAX_PARTIALS_PER_SOURCE * 5
+/* Number of entries of the scan cache, and of entries looked at for
+   a frame (see shared_scan). */
+#define SCAN_CACHE_SIZE 16
+#define SCAN_CACHE_PROBES 4
 
 #define INTERPOLATION_STEPS 8
 #define STEP_SAMPLES (SAS_SAMPLES / INTERPOLATION_STEPS)
 
+/* Tolerances for the synthesis of a partial with fewer steps than
+   INTERPOLATION_STEPS (see interpolation_steps): maximal phase drift
+   (in radians) and maximal amplitude error with regard to a synthesis
+   with INTERPOLATION_STEPS steps. */
+#define PHASE_TOLERANCE 1e-3
+#define AMPLITUDE_TOLERANCE MIN_AMP
+
+/* Harmonic groups (see make_segments): minimal number of harmonics
+   in a group, maximal relative amplitude error of a harmonic in a
+   group, maximal ratio between amplitudes of consecutive harmonics,
+   and minimal denominator of the discrete summation formula. */
+#define MIN_GROUP_HARMONICS 8
+#define GROUP_TOLERANCE 1e-2
+#define MAX_GROUP_RATIO 2.0
+#define MIN_GROUP_DENOMINATOR 1e-4
+
 #define FREQCOEFF ((2.0 * M_PI) / SAS_SAMPLING_RATE)
 
 #define MIN_BARK 0.2
@@ -59,12 +91,36 @@
 #define LEFT_LINE_COEFF 27.0
 #define RIGHT_LINE_COEFF (-15.0)
 
+/* Incremental masking (see update_mask_incrementally): width (in
+   Bark) and number of the bands in which masking is recomputed,
+   spread (in bands) of a change in the spectrum, and hysteresis on
+   frequency (relative) and amplitude (ratio, 1 dB) under which a
+   partial is considered unchanged. */
+#define MASK_BAND_WIDTH 0.25
+#define MASK_BANDS 109 /* MAX_BARK / MASK_BAND_WIDTH + 1 */
+#define MASK_SPREAD_BANDS 8
+#define MASK_F_HYSTERESIS 1e-2
+#define MASK_A_HYSTERESIS 1.122
+
 #define SOUND_CELERITY     350.0 /* m/s */
 #define MAX_PROPAGATION_DISTANCE 2000.0 /* m */
 #define MAX_PROPAGATED_FRAMES \
   ((int) ((MAX_PROPAGATION_DISTANCE / SOUND_CELERITY) * \
           (SAS_SAMPLING_RATE / SAS_SAMPLES)))
 
+/* The noise of frames (see noise_synthesis) is synthesized by frames
+   of NOISE_SIZE samples, overlapped every NOISE_HOP samples, with
+   NOISE_BINS frequency bins (all of them but DC and Nyquist). */
+#define NOISE_SIZE SAS_SAMPLES
+#define NOISE_HOP (NOISE_SIZE / 2)
+#define NOISE_BINS (NOISE_SIZE / 2 - 1)
+#define NOISE_BIN_WIDTH (SAS_SAMPLING_RATE / NOISE_SIZE)
+/* Bin amplitude of a white noise with the power of a sinusoid of
+   amplitude 1: the power of a frame is twice the sum of the squares
+   of the bin amplitudes, and a sinusoid of amplitude 1 has power
+   1/2. */
+#define NOISE_NORMALIZATION (0.5 / sqrt (NOISE_BINS))
+
 #ifdef USE_RESONATOR
 /* Trying to fix the "resonator bug". */
 #define BELOW_MIN_AMP (0.1 * MIN_AMP)
@@ -72,15 +128,60 @@
 #define BELOW_MIN_AMP 0.0
 #endif
 
-typedef struct partial_s * partial_t;
+typedef struct sas_partial_s * partial_t;
 typedef struct masking_partial_s * masking_partial_t;
 typedef struct pool_of_masking_partials_s * pool_of_masking_partials_t;
 typedef struct skip_list_s * skip_list_t;
+typedef struct harmonic_segment_s * harmonic_segment_t;
+typedef struct harmonic_scan_s * harmonic_scan_t;
+typedef struct queued_frame_s * queued_frame_t;
+
+/* The harmonics of a frame, as scanned by scan_source (see
+   scan_harmonics).  Sources that hear frames with the same color,
+   warp and fundamental frequency during a block share one scan,
+   whatever their amplitudes, kept in the scan cache of the
+   synthesizer (see shared_scan). */
+struct harmonic_scan_s {
+  /* The frame (but its amplitude), and the block of the scan (-1 if
+     none). */
+  sas_envelope_t color;
+  sas_envelope_t warp;
+  double frequency;
+  int block;
+  /* 1 once the scan is complete. */
+  int ready;
+  /* Warped frequencies, colors and audibility thresholds (see
+     amplitude_threshold) of the 'count' harmonics of the fundamental
+     below Nyquist's frequency.  Harmonics warped beyond Nyquist's
+     frequency have color BELOW_MIN_AMP and an infinite threshold.
+     Which harmonics are heard depends on the amplitude of the frame,
+     and is decided by each source (see scan_source).  (Arrays of
+     MAX_PARTIALS_PER_SOURCE values, in one allocation.) */
+  int count;
+  double * f;
+  double * c;
+  double * threshold;
+};
+
+/* An entry of the frame queue of a source (see
+   sas_synthesizer_source_queue): a frame and a position, due at
+   'time'.  'moved' is 0 if the position is kept. */
+struct queued_frame_s {
+  double time;
+  sas_frame_t frame;
+  struct sas_position_s position;
+  int moved;
+};
 
 struct sas_synthesizer_s {
   /* Simply linked list of sources. */
   sas_source_t sources;
   int number_of_sources;
+  /* Number of sources made so far, used to number them. */
+  int number_of_made_sources;
+  /* The trace the input is recorded into, or NULL (see
+     sas_synthesizer_record). */
+  sas_trace_t trace;
   /* 1 / (log_2(number of sources) + 1). */
   double amplitude_factor;
   /* Pointers to the harmonics currently linked. */
@@ -94,44 +195,197 @@ struct sas_synthesizer_s {
   sas_envelope_t threshold;
   /* Partials sorted by decreasing amplitudes (for qsort). */
   partial_t * tracks2;
+  /* Partials heard in the last block (see sas_synthesizer_tap). */
+  partial_t * tapped;
   /* Spectral mask of partials. */
   skip_list_t mask;
   pool_of_masking_partials_t pool;
+  /* 1 if masking is only recomputed where the spectrum changed. */
+  int incremental_masking;
+#ifdef _REENTRANT
+  /* Worker threads for the scan of sources (see update_sources), and
+     their synchronization. */
+  pthread_t * workers;
+  int number_of_workers;
+  pthread_mutex_t work_lock;
+  pthread_cond_t work_start;
+  pthread_cond_t work_done;
+  /* Incremented each time a new scan starts. */
+  unsigned int generation;
+  int pending_workers;
+  int quit;
+  /* Sources to scan, and index of the next one to take.  The array
+     has room for all sources (see source_array_size). */
+  sas_source_t * source_array;
+  int source_array_size;
+  int number_of_scanned_sources;
+  int next_source;
+#endif
+  /* Last block synthesized for sas_synthesizer_render, and position of
+     the next sample to output in it (SAS_SAMPLES if none left). */
+  double * block;
+  int block_position;
+  /* Bands of the spectrum (see MASK_BANDS) in which masking must be
+     recomputed, in incremental masking mode. */
+  char mask_dirty[MASK_BANDS];
+  /* Interpolation mode of amplitude and frequency. */
+  sas_interpolation_t interpolation;
+  /* Coefficients for the interpolation of amplitude and frequency
+     during synthesis. */
+  double icoeffs[INTERPOLATION_STEPS][4];
+  /* Integrals of the above coefficients over a block, as functions of
+     time.  (For the phase advance of silent partials.) */
+  double phase_coeffs[4];
+  /* Bound on the sum of the absolute values of the coefficients. */
+  double amplitude_bound;
+  /* 1 if the harmonics of sources with the identity warp are
+     synthesized from one fundamental phasor per source (see
+     synthesize_locked_source). */
+  int harmonic_locking;
+  /* 1 if runs of locked harmonics with geometric amplitudes are
+     synthesized in closed form (see make_segments). */
+  int harmonic_groups;
+  /* HRTF set of the binaural mode (see sas_synthesizer_set_hrtf),
+     NULL for panning. */
+  sas_hrtf_t hrtf;
+  /* Work arrays of MAX_PARTIALS_PER_SOURCE amplitudes, amplitude
+     increments and segments for synthesize_locked_source. */
+  double * locked_amplitudes;
+  double * locked_increments;
+  harmonic_segment_t segments;
+  /* Synthesis goes from point 'origin' to point 'origin' + 1 of the
+     interpolation envelopes of partials (see struct sas_partial_s). */
+  int origin;
+  /* State at which young partials are inserted into the synthesizer,
+     so that their fade-in starts at point 'origin'. */
+  int insertion_state;
+  /* State of the generator of the initial phases of partials and the
+     phases of noise (see sas_random and sas_synthesizer_set_seed). */
+  unsigned long random_state;
+  /* Number of blocks synthesized so far. */
+  int blocks;
+  /* Power spectra of the noise of the sources (see noise_synthesis),
+     on the left and right channels and their cross spectrum, for the
+     current block (noise_power[noise_current]) and the previous
+     one. */
+  double noise_power[2][3][NOISE_BINS];
+  int noise_current;
+  /* 1 if the previous block had noise. */
+  int noisy;
+  /* Synthesis window, and the interleaved second half of the last
+     noise frame, to be overlapped with the next one. */
+  double noise_window[NOISE_SIZE];
+  double noise_overlap[2 * NOISE_HOP];
+  /* Scans of harmonics shared by the sources during a block, and the
+     number of sources that took the scan of another one in the last
+     block. */
+  struct harmonic_scan_s scan_cache[SCAN_CACHE_SIZE];
+  int shared_scans;
+#ifdef _REENTRANT
+  pthread_mutex_t scan_cache_lock;
+#endif
+  /* Real-time guard: number of events of each kind (see
+     SAS_RT_EVENT) since the synthesizer was made. */
+  int rt_events[SAS_RT_EVENTS];
 };
 
 struct sas_source_s {
+  /* NULL for sources updated with sas_synthesizer_bulk_update. */
   sas_update_callback_t update;
   void * call_data;
+  /* 1 if a frame and a position were pushed into the emission point
+     by sas_synthesizer_bulk_update since the last block. */
+  int pushed;
+  /* 1 if the last scan took a new frame and position. */
+  int updated;
+  /* Number of the source in the synthesizer, for traces. */
+  int number;
   /* MAX_PROPAGATED_FRAMES frames.  (Circular buffer.) */
   sas_frame_t * propagated_frames;
   /* Current emission point in the circular buffer above. */
   int emission_index;
+  /* Entry of the circular buffer holding the frame given last by
+     sas_synthesizer_bulk_update or the queue (see dequeue_frame),
+     whatever the blocks frozen since. */
+  int given_index;
   /* The current position of the source. */
   struct sas_position_s position;
   /* Distance of the source with regard to the listener. */
   double distance;
   /* Cosine of the angle between the listener and the source. */
   double cos_angle;
+  /* Same with the front (y) and up (z) axes, for the binaural mode
+     (cos_angle being the one with the right axis). */
+  double cos_front;
+  double cos_up;
+  /* 1 if the partials have their own gains (see binaural_gains). */
+  int binaural;
   /* Doppler factor.  (From the listener point of view.) */
   double doppler;
   /* Left channel amplitude ratio.  (From the listener point of view.)  */
   double l_ratio;
   /* Right channel amplitude ratio.  (From the listener point of view.) */
   double r_ratio;
-  /* A pointer to the MAX_PARTIALS_PER_SOURCE harmonics. */
+  /* A pointer to the harmonics, and their number (at most
+     MAX_PARTIALS_PER_SOURCE). */
   partial_t tracks;
+  int allocated_tracks;
+  /* Number of partials the last scan would have used, if more than
+     allocated (see grow_sources). */
+  int wanted_tracks;
   /* Number of harmonics considered active. */
   int active_tracks;
   /* Number of harmonics linked into synthesizer. */
   int linked_tracks;
+  /* Number of audible harmonics, and of harmonics that stay active,
+     found by the last scan (see scan_source). */
+  int scanned_harmonics;
+  int scanned_active;
   /* Next source in synthesizer. */
   sas_source_t next;
   /* If the deletion of the source has been requested, but was
      delayed. */
   int delayed_free;
+  /* Future fundamental frequency (heard frequency, including Doppler
+     factor). */
+  double f;
+  /* Interpolation envelope for the fundamental frequency. */
+  double fenv[4];
+  /* 1 if the heard frame has the identity warp, that is if partials
+     are exact multiples of the fundamental frequency. */
+  int harmonic;
+  /* 1 if the partials are currently synthesized from the phasor of
+     the fundamental (v1, v2) instead of their own phasors. */
+  int locked;
+  double v1, v2;
+  /* Power spectrum of the noise of the heard frame, at the bins of
+     noise synthesis (NULL until the source has noise), and 1 if the
+     noise is heard. */
+  double * noise_power;
+  int noisy;
+  /* Partials given by sas_synthesizer_source_set_partials instead of
+     frames: their number (-1 if the source is updated with frames),
+     and the room allocated for them. */
+  int raw_partials;
+  int raw_allocated;
+  double * raw_frequencies;
+  double * raw_amplitudes;
+  /* Number of blocks since the source last emitted something (a
+     frame with a non-zero amplitude, or partials). */
+  int silent_blocks;
+  /* 1 if the source sleeps (see source_falls_asleep). */
+  int dormant;
+  /* Frame queue (NULL if none) of 'queue_size' entries.  Entry
+     'queue_head' % 'queue_size' is the next one written by the
+     client, and entry 'queue_tail' % 'queue_size' the next one read by
+     the synthesizer: each index is only written by its own side. */
+  queued_frame_t queue;
+  unsigned int queue_size;
+  unsigned int queue_head;
+  unsigned int queue_tail;
 };
 
-struct partial_s {
+struct sas_partial_s {
   /* The source that contains this partial. */
   sas_source_t source;
   /* Link to the corresponding track in synthesizer (if not NULL). */
@@ -144,10 +398,47 @@ struct partial_s {
   double fenv[4];
   /* Interpolation envelope for amplitude. */
   double aenv[4];
-  /* Update state of partial. */
+  /* Update state of partial.  Young partials are inserted into the
+     synthesizer when their state reaches the insertion state (see
+     struct sas_synthesizer_s), and dying ones are removed when it
+     reaches its opposite. */
   int state;
   /* Synthesis state. */
   double v1, v2;
+  /* Incremental masking: 1 if the following fields are valid, that is
+     if the partial was audible at the last evaluation of its
+     masking. */
+  int mask_valid;
+  /* Frequency and left and right amplitudes at the last evaluation. */
+  double mask_f;
+  double mask_a_left, mask_a_right;
+  /* Contribution to the mask (see struct masking_partial_s). */
+  double mask_freqB;
+  double mask_min_vdB, mask_max_vdB;
+  /* 1 if the partial is masked, and 1 if its contribution is part of
+     the mask. */
+  int masked;
+  int mask_contributes;
+  /* Binaural mode: left and right gains of the partial, instead of
+     the ones of its source, and the coefficients of the sine and
+     cosine of its phase in each channel (the gains with the phase
+     offsets of the interaural time difference). */
+  double l_gain, r_gain;
+  double l_sin, l_cos;
+  double r_sin, r_cos;
+#ifndef USE_RESONATOR
+  /* Rotation increment of the oscillator, and the frequency it
+     corresponds to (negative if none). */
+  double r_inc, i_inc;
+  double inc_f;
+  /* Phase advance not yet applied to the phasor (v1, v2), while the
+     partial is silent. */
+  double pending_phase;
+#endif
+  /* Reference synthesis (see reference_synthesis): phase of the
+     partial at the start of block 'reference_block' + 1. */
+  double reference_phase;
+  int reference_block;
 };
 
 struct masking_partial_s {
@@ -158,6 +449,8 @@ struct masking_partial_s {
   double max_vdB;
   /* Frequency in Bark. */
   double freqB;
+  /* 1 if the contribution is part of the mask (not masked itself). */
+  int in_mask;
 };
 
 struct pool_of_masking_partials_s {
@@ -166,9 +459,19 @@ struct pool_of_masking_partials_s {
   int used;
 };
 
-/* Coefficients for the interpolation of amplitude and frequency
-   during synthesis. */
-static double icoeffs[INTERPOLATION_STEPS][4];
+/* Consecutive harmonics of a locked source, during one interpolation
+   step. */
+struct harmonic_segment_s {
+  /* Index of the first harmonic, and number of harmonics. */
+  int first;
+  int count;
+  /* 1 if the amplitudes of the harmonics are a * ratio ^ j (j = 0 to
+     count - 1), and the segment is synthesized in closed form. */
+  int group;
+  double a, a_inc;
+  double ratio;
+  double ratio_n;
+};
 
 /*======================================================================*/
 /* Local functions */
@@ -196,15 +499,40 @@ compare_frequencies (const void * e1, const void * e2)
    needed for optimization (inlining, specialization, etc.). */
 #include "skip_list.c"
 
+#ifdef SAS_RT_GUARD
+
+/* The synthesizer that synthesizes a block in the calling thread, if
+   any. */
+static SAS_THREAD_LOCAL sas_synthesizer_t rt_synthesizer = NULL;
+
+void
+sas_rt_event (int event, const char * where, int * reported)
+{
+  static const char * names[SAS_RT_EVENTS] = {
+    "allocation", "lock", "system call", "exit"
+  };
+
+  if (rt_synthesizer == NULL)
+    return;
+
+  SAS_ATOMIC_INCREMENT (rt_synthesizer->rt_events[event]);
+
+  if (SAS_ATOMIC_INCREMENT (*reported) == 1)
+    fprintf (stderr, "sas: real-time guard: %s in %s during synthesis.\n",
+	     names[event], where);
+}
+
+#endif
+
 /* Interpolation of amplitudes and frequencies.  Only called by
-   sas_synthesizer_synthesize. */
+   sas_synthesizer_synthesize and the partial tap. */
 static inline double
-interpolate_value (double * envelope, int step)
+interpolate_value (sas_synthesizer_t s, double * envelope, int step)
 {
-  return (icoeffs[step][0] * envelope[0] +
-	  icoeffs[step][1] * envelope[1] +
-	  icoeffs[step][2] * envelope[2] +
-	  icoeffs[step][3] * envelope[3]);
+  return (s->icoeffs[step][0] * envelope[0] +
+	  s->icoeffs[step][1] * envelope[1] +
+	  s->icoeffs[step][2] * envelope[2] +
+	  s->icoeffs[step][3] * envelope[3]);
 }
 
 static inline void
@@ -232,6 +560,10 @@ sas_synthesizer_source_delayed_free (sas_synthesizer_t s, sas_source_t source)
   else
     prev->next = current->next;
 
+  /* Called from link_source, so the frees below happen during
+     synthesis. */
+  SAS_RT_EVENT (SAS_RT_ALLOCATION);
+
   for (i = 0; i < source->linked_tracks; i++)
     {
       /* Unlink partials. */
@@ -244,6 +576,19 @@ sas_synthesizer_source_delayed_free (sas_synthesizer_t s, sas_source_t source)
 
   free (source->propagated_frames);
   free (source->tracks);
+  free (source->noise_power);
+  free (source->raw_frequencies);
+  free (source->raw_amplitudes);
+
+  if (source->queue != NULL)
+    {
+      unsigned int j;
+
+      for (j = 0; j < source->queue_size; j++)
+	sas_frame_free (source->queue[j].frame);
+      free (source->queue);
+    }
+
   free (source);
 
   s->number_of_sources--;
@@ -269,6 +614,14 @@ shift_envelope (double * envelope, double value)
   envelope[3] = value;
 }
 
+/* Returns a random phase, between 0 and 2 pi. */
+static inline double
+random_phase (sas_synthesizer_t s)
+{
+  return (2.0 * M_PI / (SAS_RANDOM_MAX + 1.0)) *
+    sas_random (&s->random_state);
+}
+
 #define ALPHA 0.05
 
 static inline void
@@ -276,6 +629,8 @@ update_source_spatial_information (sas_source_t source)
 {
   double previous_distance;
   double new_cos_angle;
+  double new_cos_front;
+  double new_cos_up;
   double new_doppler;
   /* Signed speed for Doppler. */
   double sspeed;
@@ -292,11 +647,25 @@ update_source_spatial_information (sas_source_t source)
     (source->distance > 0.0) ?
     source->position.x / source->distance :
     0.0;
+  new_cos_front =
+    (source->distance > 0.0) ?
+    source->position.y / source->distance :
+    1.0;
+  new_cos_up =
+    (source->distance > 0.0) ?
+    source->position.z / source->distance :
+    0.0;
 
   /* FIXME: why does this interpolation still produce clicks? */
   source->cos_angle =
     (1.0 - ALPHA) * source->cos_angle +
     ALPHA * new_cos_angle;
+  source->cos_front =
+    (1.0 - ALPHA) * source->cos_front +
+    ALPHA * new_cos_front;
+  source->cos_up =
+    (1.0 - ALPHA) * source->cos_up +
+    ALPHA * new_cos_up;
 
   pow2cos = pow (2.0, source->cos_angle);
   source->r_ratio =  0.5 * pow2cos;
@@ -313,11 +682,39 @@ update_source_spatial_information (sas_source_t source)
   source->doppler = (1.0 - ALPHA) * source->doppler + ALPHA * new_doppler;
 }
 
-/* Returns the amplitude factor of partials with regard to (1) their
-   frequency and (2) the distance between their source and the
+/* Sets the spatial information of a source from its position, as if
+   it had always been there. */
+static inline void
+reset_source_spatial_information (sas_source_t source)
+{
+  source->distance =
+    DISTANCE (source->position.x,
+	      source->position.y,
+	      source->position.z);
+
+  source->cos_angle =
+    (source->distance > 0.0) ?
+    source->position.x / source->distance :
+    0.0;
+  source->cos_front =
+    (source->distance > 0.0) ?
+    source->position.y / source->distance :
+    1.0;
+  source->cos_up =
+    (source->distance > 0.0) ?
+    source->position.z / source->distance :
+    0.0;
+
+  source->doppler = 1.0;
+
+  update_source_spatial_information (source);
+}
+
+/* Returns the amplitude factor of a sound with regard to (1) its
+   frequency and (2) the distance between its source and the
    listener. */
 static inline double
-compute_distance_attenuation_factor (partial_t p)
+distance_attenuation (double frequency, double distance)
 {
   double mu;
   double h;
@@ -325,175 +722,801 @@ compute_distance_attenuation_factor (partial_t p)
   h = 50.0;  /* 50% humidity. */
 
   /* Evans and Bazley.  (Air at 20C.) */
-  mu = (85.0 / h) * SQR (p->f / 1000) * 0.0001 * 8.7;
-  return exp (-mu * p->source->distance) / (p->source->distance + 1.0);
+  mu = (85.0 / h) * SQR (frequency / 1000) * 0.0001 * 8.7;
+  return exp (-mu * distance) / (distance + 1.0);
+}
+
+/* Returns the amplitude factor of partials with regard to (1) their
+   frequency and (2) the distance between their source and the
+   listener. */
+static inline double
+compute_distance_attenuation_factor (partial_t p)
+{
+  return distance_attenuation (p->f, p->source->distance);
 }
 
-/* Real update of a source. */
 static inline void
-update_source (sas_synthesizer_t s, sas_source_t source)
+partial_init (sas_source_t source, partial_t p)
 {
-  int distance_index;
-  sas_frame_t frame;
-  sas_position_t pos;
-  double frameA;
-  double frameF;
-  sas_envelope_t frameC;
-  sas_envelope_t frameW;
-  partial_t p;
-  int harmonics;
-  double amp;
-  int active;
-  int birth;
-  int death;
-  int links;
+  p->source = source;
+  p->link = NULL;
+  p->a = 0.0;
+  p->f = 440.0;
+  p->aenv[0] = p->aenv[1] = p->aenv[2] = p->aenv[3] = p->a;
+  p->fenv[0] = p->fenv[1] = p->fenv[2] = p->fenv[3] = p->f;
+  p->state = 0;
+  p->v1 = 0.0;
+  p->v2 = 0.0;
+  p->mask_valid = 0;
+  p->masked = 0;
+  p->reference_block = -1;
+  p->l_gain = p->l_sin = source->l_ratio;
+  p->r_gain = p->r_sin = source->r_ratio;
+  p->l_cos = p->r_cos = 0.0;
+#ifndef USE_RESONATOR
+  p->r_inc = 1.0;
+  p->i_inc = 0.0;
+  p->inc_f = -1.0;
+  p->pending_phase = 0.0;
+#endif
+}
+
+/* Left and right gains of a partial. */
+static inline double
+partial_l_ratio (partial_t p)
+{
+  return p->source->binaural ? p->l_gain : p->source->l_ratio;
+}
+
+static inline double
+partial_r_ratio (partial_t p)
+{
+  return p->source->binaural ? p->r_gain : p->source->r_ratio;
+}
+
+/* Makes room for at least n (at most MAX_PARTIALS_PER_SOURCE)
+   partials in a source.  The partials may move in memory, so that
+   their tracks in the synthesizer are linked again: never call it in
+   the middle of a block. */
+static inline void
+grow_tracks (sas_source_t source, int n)
+{
+  int allocated;
   int i;
 
-  harmonics = 0;
-  amp = 0.0;
-  active = 0;
+  if (n <= source->allocated_tracks)
+    return;
+
+  allocated = MAX (n, MIN (2 * source->allocated_tracks,
+			   MAX_PARTIALS_PER_SOURCE));
+
+  SAS_RT_EVENT (SAS_RT_ALLOCATION);
+  source->tracks = (partial_t)
+    realloc (source->tracks, allocated * sizeof (struct sas_partial_s));
+  assert (source->tracks);
+
+  for (i = 0; i < source->allocated_tracks; i++)
+    {
+      partial_t p;
+
+      p = source->tracks + i;
+      if (p->link != NULL)
+	*(p->link) = p;
+    }
 
-  /* Call client for new frame and position. */
+  for (; i < allocated; i++)
+    partial_init (source, source->tracks + i);
 
-  frame = NULL;
-  pos = NULL;
+  source->allocated_tracks = allocated;
+}
+
+/* Returns the number of partials a scan can use for 'harmonics'
+   harmonics.  Partials are not allocated in the middle of a block:
+   the harmonics that don't fit are left out of it, and the source
+   grows before the next one (see grow_sources). */
+static inline int
+fit_tracks (sas_source_t source, int harmonics)
+{
+  if (harmonics <= source->allocated_tracks)
+    return harmonics;
 
-  source->update (s, source, &frame, &pos, source->call_data);
+  source->wanted_tracks = MIN (harmonics, MAX_PARTIALS_PER_SOURCE);
+  return source->allocated_tracks;
+}
+
+/* Computes the power spectrum of the noise of a source, from the
+   amplitude and the noise envelope of its heard frame.  Like the
+   harmonics, the noise is shifted by the Doppler factor and
+   attenuated with distance. */
+static inline void
+scan_noise (sas_synthesizer_t s, sas_source_t source,
+	    double frameA, sas_envelope_t frameN)
+{
+  double gain;
+  int k;
 
-  if (frame == NULL || pos == NULL)
+  if (source->noise_power == NULL)
     {
-      /* Source not updated.  Freeze the emitted frame. */
-      active = source->active_tracks;
-      goto after_harmonic_scan;
+      SAS_RT_EVENT (SAS_RT_ALLOCATION);
+      source->noise_power = (double *) malloc (NOISE_BINS * sizeof (double));
+      assert (source->noise_power);
     }
 
-  /* Safe-copy the updated frame and position. */
+  gain = frameA * s->amplitude_factor * NOISE_NORMALIZATION;
 
-  sas_frame_copy (source->propagated_frames[source->emission_index], frame);
-  source->position.x = pos->x;
-  source->position.y = pos->y;
-  source->position.z = pos->z;
+  for (k = 0; k < NOISE_BINS; k++)
+    {
+      double f;
+      double a;
+
+      f = NOISE_BIN_WIDTH * (k + 1);
+      a = gain *
+	sas_envelope_get_value_inline (frameN, f / source->doppler) *
+	distance_attenuation (f, source->distance);
+      source->noise_power[k] = a * a;
+    }
 
-  /* Find the frame that the listener hears. */
+  source->noisy = 1;
+}
 
-  update_source_spatial_information (source);
+/* Scans the partials given by sas_synthesizer_source_set_partials,
+   like the harmonics of a frame (see scan_source) but without
+   envelopes, and returns the number of partials up to the last
+   audible one. */
+static inline int
+scan_partials (sas_synthesizer_t s, sas_source_t source)
+{
+  partial_t p;
+  int harmonics;
+  int i;
+
+  /* Partials are not multiples of a fundamental: never lock them. */
+  source->harmonic = 0;
 
   if (source->distance >= MAX_PROPAGATION_DISTANCE)
-    goto after_harmonic_scan;
+    return 0;
 
-  distance_index =
-    source->emission_index +
-    (source->distance * MAX_PROPAGATED_FRAMES / MAX_PROPAGATION_DISTANCE);
-  distance_index %= MAX_PROPAGATED_FRAMES;
+  harmonics = 0;
 
-  frame = source->propagated_frames[distance_index];
-  if ((frameA = sas_frame_get_amplitude (frame)) == 0.0)
-    goto after_harmonic_scan;
-  frameF = sas_frame_get_frequency (frame);
-  frameC = sas_frame_get_color (frame);
-  frameW = sas_frame_get_warp (frame);
+  for (i = 0; i < source->raw_partials; i++)
+    {
+      double f;
+
+      f = source->raw_frequencies[i];
+
+      /* For human ears, minimal audible amplitude depends on
+	 frequency. */
+      if ((f <= 0.0) || (f >= SAS_MAX_AUDIBLE_FREQUENCY) ||
+	  (source->raw_amplitudes[i] < amplitude_threshold (s, f)))
+	source->raw_amplitudes[i] = BELOW_MIN_AMP;  /* Inaudible. */
+      else
+	{
+	  /* The first audible partial stands for the fundamental, so
+	     that a later frame does not glide from a stale one. */
+	  if (harmonics == 0)
+	    source->f = f * source->doppler;
+	  harmonics = i + 1;
+	}
+    }
+
+  harmonics = fit_tracks (source, harmonics);
+
+  for (i = 0, p = source->tracks; i < harmonics; i++, p++)
+    {
+      double f;
+
+      f = source->raw_frequencies[i];
+      p->a = source->raw_amplitudes[i];
+
+      /* Partials without a valid frequency keep the previous one,
+	 silently. */
+      if (f > 0.0)
+	{
+	  p->a *= s->amplitude_factor *
+	    distance_attenuation (f, source->distance);
+	  p->f = f * source->doppler;
+	}
+    }
+
+  return harmonics;
+}
 
-  /* Scan harmonics. */
+/* Fills 'scan' with the harmonics of a frame, whatever its
+   amplitude. */
+static inline void
+scan_harmonics (sas_synthesizer_t s, harmonic_scan_t scan,
+		sas_envelope_t frameC, sas_envelope_t frameW,
+		double frameF)
+{
+  int i;
 
-  for (i = 0, p = source->tracks;
+  for (i = 0;
        (frameF * (i + 1) < SAS_MAX_AUDIBLE_FREQUENCY) &&
 	 (i < MAX_PARTIALS_PER_SOURCE);
-       i++, p++)
+       i++)
     {
-      p->f = sas_envelope_get_value_inline (frameW, frameF * (i + 1));
+      double f;
 
-      if (p->f < SAS_MAX_AUDIBLE_FREQUENCY)
-	{
-	  p->a = sas_envelope_get_value_inline (frameC, p->f);
+      f = sas_envelope_get_value_inline (frameW, frameF * (i + 1));
+      scan->f[i] = f;
 
+      if (f < SAS_MAX_AUDIBLE_FREQUENCY)
+	{
+	  scan->c[i] = sas_envelope_get_value_inline (frameC, f);
 	  /* For human ears, minimal audible amplitude depends on
 	     frequency. */
-	  if (p->a * frameA < amplitude_threshold (s, p->f))
-	    p->a = BELOW_MIN_AMP;  /* Inaudible harmonic. */
-	  else
-	    {
-	      /* SM's idea: use the following formula to determine
-		 properly perceived amplitude.  Not implemented.
-
-		 A = (1/sqrt(2)) * sqrt(sum(a_i^2)). */
-	      amp += p->a;
-	      harmonics = i + 1;
-	    }
+	  scan->threshold[i] = amplitude_threshold (s, f);
+	}
+      else
+	{
+	  scan->c[i] = BELOW_MIN_AMP;
+	  scan->threshold[i] = HUGE_VAL;
 	}
     }
 
-  /* Global amplitude factor is normalized with respect to amplitude
-     parameter and color amplitudes. */
-  amp = (harmonics > 0 && amp > 0.0) ? frameA / amp : 0.0;
+  scan->count = i;
+}
 
-  /* SM's proposition: divide by [log2(number of sources) + 1] instead
-     of number of sources.  Implemented. */
-  amp *= s->amplitude_factor;
+/* 1 if harmonic i of a scan is audible in a frame of amplitude
+   frameA. */
+static inline int
+scan_audible (harmonic_scan_t scan, int i, double frameA)
+{
+  return scan->c[i] * frameA >= scan->threshold[i];
+}
 
-  for (i = 0, p = source->tracks; i < harmonics; i++, p++)
+static inline unsigned long
+hash_double (double x)
+{
+  unsigned char * c;
+  unsigned long h;
+  int i;
+
+  c = (unsigned char *) &x;
+  h = 0;
+  for (i = 0; i < (int) sizeof (double); i++)
+    h = 31 * h + c[i];
+
+  return h;
+}
+
+/* The scan cache is only shared between threads when there are
+   workers (see sas_synthesizer_set_threads): otherwise, no lock. */
+static inline void
+lock_scan_cache (sas_synthesizer_t s)
+{
+#ifdef _REENTRANT
+  if (s->number_of_workers > 0)
     {
-      p->a *= amp;
-      p->a *= compute_distance_attenuation_factor (p);
-      p->f *= source->doppler;
+      SAS_RT_EVENT (SAS_RT_LOCK);
+      pthread_mutex_lock (&s->scan_cache_lock);
     }
+#endif
+}
 
-  active = MIN (harmonics, source->active_tracks);
+static inline void
+unlock_scan_cache (sas_synthesizer_t s)
+{
+#ifdef _REENTRANT
+  if (s->number_of_workers > 0)
+    pthread_mutex_unlock (&s->scan_cache_lock);
+#endif
+}
 
- after_harmonic_scan:
+/* Looks for the scan of a frame in the scan cache.  Returns the scan
+   if it was made during this block.  Otherwise, a free entry (one
+   not used during this block) is claimed, and returned with
+   '*claimed' set to 1: the caller makes the scan (see
+   scan_harmonics), then marks it ready (see shared_scan_ready).
+   Returns NULL if the entries of the frame hold other frames of the
+   block, or if its scan is being made by another thread: the caller
+   then makes the scan on its own. */
+static inline harmonic_scan_t
+shared_scan (sas_synthesizer_t s,
+	     sas_envelope_t frameC, sas_envelope_t frameW,
+	     double frameF,
+	     int * claimed)
+{
+  harmonic_scan_t scan;
+  unsigned long h;
+  int i;
 
-  /* Update tracks (partials). */
+  h =
+    ((unsigned long) frameC >> 5) ^
+    ((unsigned long) frameW >> 9) ^
+    hash_double (frameF);
 
-  i = 0;
-  p = source->tracks;
-  birth = 0;
-  death = 0;
-  links = 0;
+  *claimed = 0;
 
-  /* Harmonics that were considered active last time, and are still
-     active now.  We enter here only if active > 0. */
-  while (i < active)
+  lock_scan_cache (s);
+
+  for (i = 0; i < SCAN_CACHE_PROBES; i++)
     {
-      p->state++;
+      scan = s->scan_cache + ((h + i) % SCAN_CACHE_SIZE);
 
-      if (p->link != NULL)
+      if (scan->block != s->blocks)
 	{
-	  /* Adult harmonic, already in synthesizer, just update
-             interpolation envelopes. */
-	  shift_envelope (p->aenv, p->a);
-	  shift_envelope (p->fenv, p->f);
+	  scan->color = frameC;
+	  scan->warp = frameW;
+	  scan->frequency = frameF;
+	  scan->block = s->blocks;
+	  scan->ready = 0;
+	  *claimed = 1;
+	  break;
 	}
-      else
+
+      if (scan->color == frameC &&
+	  scan->warp == frameW &&
+	  scan->frequency == frameF)
 	{
-	  /* Active harmonics not in synthesizer, look if it should be
-             inserted. */
-	  switch (p->state)
-	    {
-	    case 1:
-	      /* Young harmonics, not in synthesizer until it enters
-                 state 2. */
-	      shift_envelope (p->aenv, p->a);
-	      shift_envelope (p->fenv, p->f);
-	      break;
+	  if (scan->ready)
+	    s->shared_scans++;
+	  else
+	    scan = NULL;
+	  break;
+	}
+    }
 
-	    case 2:
-	      /* Young harmonics, should be inserted now. */
+  if (i == SCAN_CACHE_PROBES)
+    scan = NULL;
 
-	      /* FIXME: maybe allocation limit has been reached.
-		 There will be an audible problem if we don't have
-		 enough tracks in synthesizer to store partials. */
-	      if (s->active_tracks < s->allocated)
-		{
-		  /* New track in synthesizer. */
-		  shift_envelope (p->aenv, p->a);
-		  shift_envelope (p->fenv, p->f);
+  unlock_scan_cache (s);
 
-		  /* Guess first values in interpolation tables. */
-		  p->aenv[0] = 2.0 * p->aenv[1] - p->aenv[2];
-		  //p->fenv[0] = 2.0 * p->fenv[1] - p->fenv[2];
-		  p->fenv[0] = p->f;
-		  p->fenv[1] = p->f;
-		  p->fenv[2] = p->f;
-		  p->fenv[3] = p->f;
+  return scan;
+}
+
+static inline void
+shared_scan_ready (sas_synthesizer_t s, harmonic_scan_t scan)
+{
+  lock_scan_cache (s);
+  scan->ready = 1;
+  unlock_scan_cache (s);
+}
+
+/* Called when a source emits a frame with a non-zero amplitude, or
+   partials.  Wakes the source up if it sleeps (see
+   source_falls_asleep). */
+static inline void
+source_emits (sas_source_t source)
+{
+  source->silent_blocks = 0;
+
+  if (source->dormant)
+    {
+      source->dormant = 0;
+
+      /* The source did not follow its positions while asleep: no
+	 Doppler effect from the move. */
+      reset_source_spatial_information (source);
+    }
+}
+
+/* Puts a source to sleep, if it is silent and is heard silent: no
+   partial in the synthesizer, no noise, and no sound emitted for
+   longer than the propagation delay.  Until it emits again, a
+   dormant source is neither scanned nor linked: only its update
+   callback is called, if any, and its frame is not even copied.  The
+   frames it emitted are muted, so that none of them is heard after
+   it wakes up, whatever its new position. */
+static inline void
+source_falls_asleep (sas_source_t source)
+{
+  int delay;
+  int i;
+
+  if (source->dormant || source->delayed_free ||
+      source->linked_tracks > 0 || source->active_tracks > 0 ||
+      source->noisy)
+    return;
+
+  delay = (int)
+    (MIN (source->distance, MAX_PROPAGATION_DISTANCE) *
+     MAX_PROPAGATED_FRAMES / MAX_PROPAGATION_DISTANCE);
+
+  if (source->silent_blocks <= delay)
+    return;
+
+  for (i = 0; i < MAX_PROPAGATED_FRAMES; i++)
+    sas_frame_set_amplitude (source->propagated_frames[i], 0.0);
+
+  source->dormant = 1;
+}
+
+/* Binaural mode.  Instead of the panning ratios of its source, each
+   partial gets the gains of the HRTF set at its frequency, in the
+   direction of the source.  The interaural time difference becomes a
+   phase offset of the partial in each channel: the left one lags by
+   half the ITD, and the right one leads by as much.  This costs a
+   few operations per partial and per block, and two multiply-adds
+   per sample more than panning (see
+   partial_binaural_forward_synthesis). */
+
+/* Gain applied to the magnitudes of HRTF sets, so that magnitudes of
+   1 give the panning ratios of a source straight ahead. */
+#define BINAURAL_GAIN 0.5
+
+/* Sets the binaural gains of the first n partials of a source. */
+static inline void
+binaural_gains (sas_synthesizer_t s, sas_source_t source, int n)
+{
+  struct sas_hrtf_direction_s direction;
+  double azimuth, elevation;
+  partial_t p;
+  int i;
+
+  azimuth = (180.0 / M_PI) * atan2 (source->cos_angle, source->cos_front);
+  elevation = (180.0 / M_PI) *
+    atan2 (source->cos_up,
+	   sqrt (SQR (source->cos_angle) + SQR (source->cos_front)));
+
+  sas_hrtf_direction (s->hrtf, azimuth, elevation, &direction);
+
+  for (i = 0, p = source->tracks; i < n; i++, p++)
+    {
+      double offset;
+
+      sas_hrtf_gains (&direction, p->f, &p->l_gain, &p->r_gain);
+      p->l_gain *= BINAURAL_GAIN;
+      p->r_gain *= BINAURAL_GAIN;
+
+      offset = M_PI * p->f * direction.itd;
+      p->l_sin = p->l_gain * cos (offset);
+      p->l_cos = - p->l_gain * sin (offset);
+      p->r_sin = p->r_gain * cos (offset);
+      p->r_cos = p->r_gain * sin (offset);
+    }
+}
+
+/* Returns the time of a block, in seconds. */
+static inline double
+block_time (int block)
+{
+  return block * (SAS_SAMPLES / SAS_SAMPLING_RATE);
+}
+
+/* Takes the frame and position of a source from its queue, if an
+   entry is due at the current block: the last entry due, the ones
+   before being too late.  The frame is pushed into the emission
+   point, as by sas_synthesizer_bulk_update, and the entries read are
+   given back to the client. */
+static inline void
+dequeue_frame (sas_synthesizer_t s, sas_source_t source)
+{
+  queued_frame_t due;
+  unsigned int head, tail;
+  double now;
+
+  now = block_time (s->blocks);
+  head = SAS_ATOMIC_LOAD (source->queue_head);
+  tail = source->queue_tail;
+  due = NULL;
+
+  while (tail != head &&
+	 source->queue[tail % source->queue_size].time <= now)
+    due = source->queue + (tail++ % source->queue_size);
+
+  if (due == NULL)
+    return;
+
+  sas_frame_copy (source->propagated_frames[source->emission_index],
+		  due->frame);
+  source->given_index = source->emission_index;
+  if (due->moved)
+    source->position = due->position;
+
+  source->raw_partials = -1;
+  source->pushed = 1;
+
+  SAS_ATOMIC_STORE (source->queue_tail, tail);
+}
+
+/* Real update of a source, first part: calls the client, and scans
+   the harmonics of the heard frame.  Only touches the source, so that
+   sources can be scanned in parallel (see update_sources). */
+static inline void
+scan_source (sas_synthesizer_t s, sas_source_t source)
+{
+  int distance_index;
+  sas_frame_t frame;
+  sas_position_t pos;
+  double frameA;
+  double frameF;
+  sas_envelope_t frameC;
+  sas_envelope_t frameW;
+  sas_envelope_t frameN;
+  harmonic_scan_t scan;
+  struct harmonic_scan_s own_scan;
+  double own_f[MAX_PARTIALS_PER_SOURCE];
+  double own_c[MAX_PARTIALS_PER_SOURCE];
+  double own_threshold[MAX_PARTIALS_PER_SOURCE];
+  int claimed;
+  partial_t p;
+  int harmonics;
+  double amp;
+  int active;
+  int stored;
+  int i;
+
+  harmonics = 0;
+  amp = 0.0;
+  active = 0;
+
+  source->updated = 0;
+
+  if (source->delayed_free)
+    /* The client is done with the source: go on with its muted
+       frames. */
+    ;
+  else if (source->update == NULL)
+    {
+      /* The frame and position were pushed in place (see
+	 sas_synthesizer_bulk_update), or are due in the queue. */
+      if (source->queue != NULL)
+	dequeue_frame (s, source);
+
+      if (!source->pushed)
+	{
+	  if (source->dormant)
+	    return;
+
+	  /* Source not updated.  Freeze the emitted frame. */
+	  active = source->active_tracks;
+	  goto after_harmonic_scan;
+	}
+      source->pushed = 0;
+
+      if ((source->raw_partials >= 0) ?
+	  (source->raw_partials > 0) :
+	  (sas_frame_get_amplitude (source->propagated_frames
+				    [source->emission_index]) != 0.0))
+	source_emits (source);
+      else if (source->dormant)
+	/* Still silent. */
+	return;
+
+      if (source->raw_partials >= 0)
+	{
+	  /* Explicit partials instead of a frame: no propagation
+	     delay, no envelope and no noise. */
+	  source->updated = 1;
+	  source->noisy = 0;
+	  update_source_spatial_information (source);
+	  harmonics = scan_partials (s, source);
+	  active = MIN (harmonics, source->active_tracks);
+	  goto after_harmonic_scan;
+	}
+    }
+  else
+    {
+      /* Call client for new frame and position. */
+
+      frame = NULL;
+      pos = NULL;
+
+      source->update (s, source, &frame, &pos, source->call_data);
+
+      if (frame == NULL || pos == NULL)
+	{
+	  if (source->dormant)
+	    return;
+
+	  /* Source not updated.  Freeze the emitted frame. */
+	  active = source->active_tracks;
+	  goto after_harmonic_scan;
+	}
+
+      if (source->dormant && sas_frame_get_amplitude (frame) == 0.0)
+	/* Still silent: the frame and position are not even copied. */
+	return;
+
+      /* Safe-copy the updated frame and position. */
+
+      sas_frame_copy (source->propagated_frames[source->emission_index],
+		      frame);
+      source->position.x = pos->x;
+      source->position.y = pos->y;
+      source->position.z = pos->z;
+
+      if (sas_frame_get_amplitude (frame) != 0.0)
+	source_emits (source);
+    }
+
+  source->updated = 1;
+  source->noisy = 0;
+
+  /* Find the frame that the listener hears. */
+
+  update_source_spatial_information (source);
+
+  if (source->distance >= MAX_PROPAGATION_DISTANCE)
+    goto after_harmonic_scan;
+
+  distance_index =
+    source->emission_index +
+    (source->distance * MAX_PROPAGATED_FRAMES / MAX_PROPAGATION_DISTANCE);
+  distance_index %= MAX_PROPAGATED_FRAMES;
+
+  frame = source->propagated_frames[distance_index];
+  if ((frameA = sas_frame_get_amplitude (frame)) == 0.0)
+    goto after_harmonic_scan;
+  frameF = sas_frame_get_frequency (frame);
+  frameC = sas_frame_get_color (frame);
+  frameW = sas_frame_get_warp (frame);
+  frameN = sas_frame_get_noise (frame);
+
+  source->f = frameF * source->doppler;
+  source->harmonic = (frameW == sas_envelope_warp_identity ());
+
+  if (frameN != sas_envelope_color_0 ())
+    scan_noise (s, source, frameA, frameN);
+
+  /* Scan harmonics, unless another source already did it for the
+     same frame (whatever its amplitude) during this block. */
+
+  scan = shared_scan (s, frameC, frameW, frameF, &claimed);
+
+  if (scan == NULL)
+    {
+      own_scan.f = own_f;
+      own_scan.c = own_c;
+      own_scan.threshold = own_threshold;
+      scan = &own_scan;
+      scan_harmonics (s, scan, frameC, frameW, frameF);
+    }
+  else if (claimed)
+    {
+      scan_harmonics (s, scan, frameC, frameW, frameF);
+      shared_scan_ready (s, scan);
+    }
+
+  for (i = 0; i < scan->count; i++)
+    if (scan_audible (scan, i, frameA))
+      {
+	/* SM's idea: use the following formula to determine properly
+	   perceived amplitude.  Not implemented.
+
+	   A = (1/sqrt(2)) * sqrt(sum(a_i^2)). */
+	amp += scan->c[i];
+	harmonics = i + 1;
+      }
+
+  /* Partials are only allocated up to the last audible harmonic, so
+     that the partials of the source grow to the number of harmonics
+     actually heard.  The amplitude factor below still counts all of
+     them, so that the level does not change when the source grows. */
+
+  harmonics = fit_tracks (source, harmonics);
+  stored = MIN (scan->count, source->allocated_tracks);
+
+  for (i = 0, p = source->tracks; i < stored; i++, p++)
+    {
+      p->f = scan->f[i];
+      p->a = scan_audible (scan, i, frameA) ?
+	scan->c[i] :
+	BELOW_MIN_AMP;  /* Inaudible harmonic. */
+    }
+
+  /* Global amplitude factor is normalized with respect to amplitude
+     parameter and color amplitudes. */
+  amp = (harmonics > 0 && amp > 0.0) ? frameA / amp : 0.0;
+
+  /* SM's proposition: divide by [log2(number of sources) + 1] instead
+     of number of sources.  Implemented. */
+  amp *= s->amplitude_factor;
+
+  for (i = 0, p = source->tracks; i < harmonics; i++, p++)
+    {
+      p->a *= amp;
+      p->a *= compute_distance_attenuation_factor (p);
+      p->f *= source->doppler;
+    }
+
+  active = MIN (harmonics, source->active_tracks);
+
+ after_harmonic_scan:
+
+  if (source->linked_tracks == 0)
+    /* Nothing playing yet: no glide from an old frequency, like the
+       envelopes of new partials (see link_source). */
+    source->fenv[0] = source->fenv[1] = source->fenv[2] = source->fenv[3] =
+      source->f;
+  else
+    shift_envelope (source->fenv, source->f);
+
+  source->binaural = (s->hrtf != NULL);
+  if (source->binaural)
+    binaural_gains (s, source,
+		    MIN (MAX (MAX (harmonics, source->active_tracks),
+			      source->linked_tracks),
+			 source->allocated_tracks));
+
+  source->scanned_harmonics = harmonics;
+  source->scanned_active = active;
+}
+
+/* Real update of a source, second part: updates the tracks of the
+   source in the synthesizer, from the result of scan_source. */
+static inline void
+link_source (sas_synthesizer_t s, sas_source_t source)
+{
+  partial_t p;
+  int harmonics;
+  int active;
+  int birth;
+  int death;
+  int links;
+  int i;
+
+  harmonics = source->scanned_harmonics;
+  active = source->scanned_active;
+
+  /* Update tracks (partials). */
+
+  i = 0;
+  p = source->tracks;
+  birth = 0;
+  death = 0;
+  links = 0;
+
+  /* Harmonics that were considered active last time, and are still
+     active now.  We enter here only if active > 0. */
+  while (i < active)
+    {
+      p->state++;
+
+      if (p->link != NULL)
+	{
+	  /* Adult harmonic, already in synthesizer, just update
+             interpolation envelopes. */
+	  shift_envelope (p->aenv, p->a);
+	  shift_envelope (p->fenv, p->f);
+	}
+      else
+	{
+	  /* Active harmonics not in synthesizer, look if it should be
+             inserted. */
+	  if (p->state < s->insertion_state)
+	    {
+	      /* Young harmonics, not in synthesizer until it enters
+                 the insertion state. */
+	      shift_envelope (p->aenv, p->a);
+	      shift_envelope (p->fenv, p->f);
+	    }
+	  else if (p->state <= 2)
+	    {
+	      /* Young harmonics, should be inserted now.  (State 2 may
+		 be reached in low-latency mode if the interpolation
+		 mode just changed.) */
+
+	      /* FIXME: maybe allocation limit has been reached.
+		 There will be an audible problem if we don't have
+		 enough tracks in synthesizer to store partials. */
+	      if (s->active_tracks < s->allocated)
+		{
+		  /* New track in synthesizer. */
+		  shift_envelope (p->aenv, p->a);
+		  shift_envelope (p->fenv, p->f);
+
+		  /* Guess first values in interpolation tables. */
+		  p->aenv[s->origin - 1] =
+		    2.0 * p->aenv[s->origin] - p->aenv[s->origin + 1];
+		  //p->fenv[0] = 2.0 * p->fenv[1] - p->fenv[2];
+		  if (source->harmonic)
+		    {
+		      /* A harmonic joining the others follows the
+			 fundamental (see synthesize_locked_source). */
+		      p->fenv[0] = (i + 1) * source->fenv[0];
+		      p->fenv[1] = (i + 1) * source->fenv[1];
+		      p->fenv[2] = (i + 1) * source->fenv[2];
+		      p->fenv[3] = (i + 1) * source->fenv[3];
+		    }
+		  else
+		    {
+		      p->fenv[0] = p->f;
+		      p->fenv[1] = p->f;
+		      p->fenv[2] = p->f;
+		      p->fenv[3] = p->f;
+		    }
 
 		  {
 		    /* Initialize sinusoidal parameters. */
@@ -505,23 +1528,28 @@ update_source (sas_synthesizer_t s, sas_source_t source)
 #else
 		    double phi; /* Initial phase. */
 
-		    phi = ((double) random ()) / RAND_MAX;
+		    phi = random_phase (s);
 		    p->v1 = cos (phi);
 		    p->v2 = sin (phi);
+		    p->inc_f = -1.0;
+		    p->pending_phase = 0.0;
 #endif
 		  }
 
+		  p->mask_valid = 0;
+		  p->masked = 0;
+
 		  p->link = s->tracks + s->active_tracks;
 		  s->tracks[s->active_tracks] = p;
 		  s->active_tracks++;
 		  links++;
 		}
-	      break;
-
-	    default:
+	    }
+	  else
+	    {
+	      SAS_RT_EVENT (SAS_RT_EXIT);
 	      fprintf (stderr, "update_source: fatal: unlinked adult harmonic.\n");
 	      exit (EXIT_FAILURE);
-	      break;
 	    }
 	}
 
@@ -572,7 +1600,7 @@ update_source (sas_synthesizer_t s, sas_source_t source)
     {
       p->state--;
 
-      if (p->state == -2)
+      if (p->state <= - s->insertion_state)
 	{
 	  /* Can be safely removed from synthesizer now. */
 	  *(p->link) = NULL;
@@ -598,47 +1626,246 @@ update_source (sas_synthesizer_t s, sas_source_t source)
   source->emission_index = (source->emission_index == 0) ?
     MAX_PROPAGATED_FRAMES - 1 : source->emission_index - 1;
 
+  if (source->silent_blocks < MAX_PROPAGATED_FRAMES)
+    source->silent_blocks++;
+  source_falls_asleep (source);
+
   /* Look if a source on which a deletion request is pending can be
      deleted. */
   if (source->delayed_free && source->linked_tracks == 0)
     sas_synthesizer_source_delayed_free (s, source);
 }
 
+#ifdef _REENTRANT
+
+/* Scans the sources of s->source_array not yet taken by another
+   thread. */
 static inline void
-update_sources (sas_synthesizer_t s)
+scan_shared_sources (sas_synthesizer_t s)
 {
-  sas_source_t current;
+  int i;
 
-  current = s->sources;
-  while (current != NULL)
+  while ((i = __sync_fetch_and_add (&s->next_source, 1)) <
+	 s->number_of_scanned_sources)
+    scan_source (s, s->source_array[i]);
+}
+
+static void *
+worker_main (void * data)
+{
+  sas_synthesizer_t s;
+  unsigned int generation;
+  int quit;
+
+  s = (sas_synthesizer_t) data;
+  generation = 0;
+
+  for (;;)
     {
-      update_source (s, current);
-      current = current->next;
+      pthread_mutex_lock (&s->work_lock);
+      while (s->generation == generation && !s->quit)
+	pthread_cond_wait (&s->work_start, &s->work_lock);
+      generation = s->generation;
+      quit = s->quit;
+      pthread_mutex_unlock (&s->work_lock);
+
+      if (quit)
+	break;
+
+#ifdef SAS_RT_GUARD
+      rt_synthesizer = s;
+#endif
+      scan_shared_sources (s);
+#ifdef SAS_RT_GUARD
+      rt_synthesizer = NULL;
+#endif
+
+      pthread_mutex_lock (&s->work_lock);
+      if (--s->pending_workers == 0)
+	pthread_cond_signal (&s->work_done);
+      pthread_mutex_unlock (&s->work_lock);
     }
+
+  return NULL;
 }
 
-/* Compare function for partials; used as a callback for qsort;
-   decreasing amplitudes. */
-static int
-compare_amplitudes (const void * e1, const void * e2)
+static inline void
+start_workers (sas_synthesizer_t s, int n)
 {
-  partial_t p1;
-  partial_t p2;
+  int i;
 
-  p1 = *((partial_t *) e1);
-  p2 = *((partial_t *) e2);
+  s->workers = (pthread_t *) malloc (n * sizeof (pthread_t));
+  assert (s->workers);
+  s->number_of_workers = n;
 
-  /* Note: should return an integer, so be careful with floating point
-     numbers.  This expression is similar to one found in the GNU C
-     library documentation. */
-  return (p1->a < p2->a) - (p2->a < p1->a);
+  for (i = 0; i < n; i++)
+    if (pthread_create (s->workers + i, NULL, worker_main, s) != 0)
+      {
+	fprintf (stderr, "sas_synthesizer_set_threads: fatal: cannot create thread.\n");
+	exit (EXIT_FAILURE);
+      }
 }
 
-/* Just in the case of profiling.  This function will be included into
-   the profile if you define the keyword 'inline' as nothing (see top
-   of file) and don't use high optimization options. */
 static inline void
-my_qsort (void * base,
+stop_workers (sas_synthesizer_t s)
+{
+  int i;
+
+  if (s->number_of_workers == 0)
+    return;
+
+  pthread_mutex_lock (&s->work_lock);
+  s->quit = 1;
+  pthread_cond_broadcast (&s->work_start);
+  pthread_mutex_unlock (&s->work_lock);
+
+  for (i = 0; i < s->number_of_workers; i++)
+    pthread_join (s->workers[i], NULL);
+
+  free (s->workers);
+  s->workers = NULL;
+  s->number_of_workers = 0;
+  s->quit = 0;
+}
+
+/* Scans all sources, with the workers and the calling thread. */
+static inline void
+scan_sources_in_parallel (sas_synthesizer_t s)
+{
+  sas_source_t current;
+  int n;
+
+  n = 0;
+  for (current = s->sources; current != NULL; current = current->next)
+    s->source_array[n++] = current;
+
+  s->number_of_scanned_sources = n;
+  s->next_source = 0;
+
+  SAS_RT_EVENT (SAS_RT_LOCK);
+  pthread_mutex_lock (&s->work_lock);
+  s->pending_workers = s->number_of_workers;
+  s->generation++;
+  pthread_cond_broadcast (&s->work_start);
+  pthread_mutex_unlock (&s->work_lock);
+
+  scan_shared_sources (s);
+
+  pthread_mutex_lock (&s->work_lock);
+  while (s->pending_workers > 0)
+    pthread_cond_wait (&s->work_done, &s->work_lock);
+  pthread_mutex_unlock (&s->work_lock);
+}
+
+#endif
+
+/* Allocates the partials that the sources lacked in the last block
+   (see fit_tracks), before the next one.  Sources that are given
+   more harmonics than ever before thus allocate memory in the thread
+   that synthesizes, unless their partials are reserved (see
+   sas_synthesizer_source_reserve). */
+static inline void
+grow_sources (sas_synthesizer_t s)
+{
+  sas_source_t source;
+
+  for (source = s->sources; source != NULL; source = source->next)
+    if (source->wanted_tracks > source->allocated_tracks)
+      grow_tracks (source, source->wanted_tracks);
+}
+
+static inline void
+update_sources (sas_synthesizer_t s)
+{
+  sas_source_t current;
+  sas_source_t next;
+
+  s->shared_scans = 0;
+
+#ifdef _REENTRANT
+  if (s->number_of_workers > 0 && s->number_of_sources > 1)
+    scan_sources_in_parallel (s);
+  else
+#endif
+    for (current = s->sources; current != NULL; current = current->next)
+      scan_source (s, current);
+
+  /* Link in the order of the sources, so that the result does not
+     depend on the threads.  (A source may be deleted by link_source,
+     see sas_synthesizer_source_delayed_free.) */
+  for (current = s->sources; current != NULL; current = next)
+    {
+      next = current->next;
+
+      if (current->dormant)
+	continue;
+
+      if (s->trace != NULL && current->updated && !current->delayed_free)
+	{
+	  if (current->raw_partials >= 0)
+	    sas_trace_write_partials (s->trace, current->number,
+				      current->raw_partials,
+				      current->raw_frequencies,
+				      current->raw_amplitudes,
+				      &current->position);
+	  else
+	    sas_trace_write_frame (s->trace, current->number,
+				   current->propagated_frames
+				   [current->emission_index],
+				   &current->position);
+	}
+
+      link_source (s, current);
+    }
+
+  if (s->trace != NULL)
+    sas_trace_write_block (s->trace);
+}
+
+/* Frequency in Bark to band of the spectrum, for incremental
+   masking. */
+static inline int
+mask_band (double freqB)
+{
+  return MIN ((int) (freqB * (1.0 / MASK_BAND_WIDTH)), MASK_BANDS - 1);
+}
+
+/* Requests that masking be recomputed around 'freqB' (in Bark). */
+static inline void
+mark_mask_dirty (sas_synthesizer_t s, double freqB)
+{
+  int band, first, last;
+
+  band = mask_band (freqB);
+  first = MAX (band - MASK_SPREAD_BANDS, 0);
+  last = MIN (band + MASK_SPREAD_BANDS, MASK_BANDS - 1);
+
+  for (band = first; band <= last; band++)
+    s->mask_dirty[band] = 1;
+}
+
+/* Compare function for partials; used as a callback for qsort;
+   decreasing amplitudes. */
+static int
+compare_amplitudes (const void * e1, const void * e2)
+{
+  partial_t p1;
+  partial_t p2;
+
+  p1 = *((partial_t *) e1);
+  p2 = *((partial_t *) e2);
+
+  /* Note: should return an integer, so be careful with floating point
+     numbers.  This expression is similar to one found in the GNU C
+     library documentation. */
+  return (p1->a < p2->a) - (p2->a < p1->a);
+}
+
+/* Just in the case of profiling.  This function will be included into
+   the profile if you define the keyword 'inline' as nothing (see top
+   of file) and don't use high optimization options. */
+static inline void
+my_qsort (void * base,
 	  size_t nmemb,
 	  size_t size,
 	  int (* compar)(const void *, const void *))
@@ -669,6 +1896,12 @@ update_tracks (sas_synthesizer_t s)
              s->tracks2. */
 	  if (p->a > BELOW_MIN_AMP)
 	    s->tracks2[s->audible_tracks++] = p;
+	  else if (p->mask_valid)
+	    {
+	      /* Its contribution leaves the mask. */
+	      mark_mask_dirty (s, p->mask_freqB);
+	      p->mask_valid = 0;
+	    }
 
 	  /* Shift-compact (a closed track leaves a gap). */
 	  *dst = p;
@@ -683,11 +1916,14 @@ update_tracks (sas_synthesizer_t s)
      links in partials: blind permutation of two tracks produces
      semantic inconsistencies.  Instead, use s->tracks2. */
 
-  /* Sort by decreasing amplitudes. */
-  my_qsort (s->tracks2,
-	    s->audible_tracks,
-	    sizeof (partial_t),
-	    compare_amplitudes);
+  /* Sort by decreasing amplitudes.  (In incremental masking mode,
+     only the partials whose masking is recomputed are sorted, see
+     update_mask_incrementally.) */
+  if (!s->incremental_masking)
+    my_qsort (s->tracks2,
+	      s->audible_tracks,
+	      sizeof (partial_t),
+	      compare_amplitudes);
 
   s->active_tracks -= closed_tracks;
 }
@@ -709,14 +1945,13 @@ a2dB (double amplitude)
 }
 
 static inline masking_partial_t
-masking_partial_make (sas_synthesizer_t s, partial_t p)
+masking_partial_alloc (sas_synthesizer_t s, partial_t p)
 {
   masking_partial_t mp;
-  double vdB_left;
-  double vdB_right;
 
   if (s->pool->used == s->pool->allocated)
     {
+      SAS_RT_EVENT (SAS_RT_ALLOCATION);
       s->pool->allocated += MAX_PARTIALS_PER_SYNTH;
       s->pool->partials = (masking_partial_t)
 	realloc (s->pool->partials,
@@ -725,9 +1960,21 @@ masking_partial_make (sas_synthesizer_t s, partial_t p)
 
   mp = s->pool->partials + s->pool->used++;
   mp->p = p;
+
+  return mp;
+}
+
+static inline masking_partial_t
+masking_partial_make (sas_synthesizer_t s, partial_t p)
+{
+  masking_partial_t mp;
+  double vdB_left;
+  double vdB_right;
+
+  mp = masking_partial_alloc (s, p);
   mp->freqB = f2B (p->f);
-  vdB_left = a2dB (p->a * p->source->l_ratio);
-  vdB_right = a2dB (p->a * p->source->r_ratio);
+  vdB_left = a2dB (p->a * partial_l_ratio (p));
+  vdB_right = a2dB (p->a * partial_r_ratio (p));
 
   if (vdB_left < vdB_right)
     {
@@ -745,9 +1992,10 @@ masking_partial_make (sas_synthesizer_t s, partial_t p)
 
 /* Updates mask with a partial p.  Returns 0 if p is masked, 1
    otherwise.  Should be called with partials of decreasing
-   amplitude. */
+   amplitude.  If 'mp' is not NULL, it is set to the contribution of
+   p. */
 static inline int
-add_partial_to_mask (sas_synthesizer_t s, partial_t p)
+add_partial_to_mask (sas_synthesizer_t s, partial_t p, masking_partial_t * mp)
 {
   masking_partial_t new_mp;
   masking_partial_t mp_lowf;
@@ -770,7 +2018,11 @@ add_partial_to_mask (sas_synthesizer_t s, partial_t p)
 
   v = MAX (v_lowf, v_highf);
 
-  if (new_mp->min_vdB - DB_DIFF < v)
+  if (mp != NULL)
+    *mp = new_mp;
+
+  new_mp->in_mask = (new_mp->min_vdB - DB_DIFF >= v);
+  if (!new_mp->in_mask)
     /* The partial's contribution to the mask is already masked. */
     skip_list_remove (s->mask, new_mp);
 
@@ -799,7 +2051,10 @@ update_mask (sas_synthesizer_t s)
 
       p = s->tracks2[i];
 
-      if (add_partial_to_mask (s, p) == 0)
+      /* (p->masked is only kept for the partial tap, see
+	 sas_partial_is_masked.) */
+      p->masked = (add_partial_to_mask (s, p, NULL) == 0);
+      if (p->masked)
 	{
 	  /* The partial is masked. */
 	  s->masked_tracks++;
@@ -810,18 +2065,208 @@ update_mask (sas_synthesizer_t s)
   s->audible_tracks -= s->masked_tracks;
 }
 
+/* Returns 1 if the frequency or the amplitudes of p moved beyond the
+   hysteresis thresholds since the last evaluation of its masking. */
+static inline int
+mask_inputs_changed (partial_t p)
+{
+  double a_left, a_right;
+
+  a_left = p->a * partial_l_ratio (p);
+  a_right = p->a * partial_r_ratio (p);
+
+  return
+    (fabs (p->f - p->mask_f) > MASK_F_HYSTERESIS * p->mask_f) ||
+    (a_left > MASK_A_HYSTERESIS * p->mask_a_left) ||
+    (a_left * MASK_A_HYSTERESIS < p->mask_a_left) ||
+    (a_right > MASK_A_HYSTERESIS * p->mask_a_right) ||
+    (a_right * MASK_A_HYSTERESIS < p->mask_a_right);
+}
+
+/* Incremental version of update_mask.  The masking inputs and verdict
+   of each partial are kept from block to block.  Only the partials
+   lying in bands where the spectrum changed (partials that appeared,
+   disappeared or moved beyond the hysteresis thresholds, plus a
+   spread of MASK_SPREAD_BANDS bands) are evaluated again, in a mask
+   made of the contributions of the unchanged partials around them.
+   The other partials keep their verdict, so the cost depends on the
+   amount of change in the spectrum. */
+static inline void
+update_mask_incrementally (sas_synthesizer_t s)
+{
+  char near[MASK_BANDS];
+  int dirty;
+  int evaluated;
+  int band;
+  int i;
+
+  /* Changed partials. */
+  for (i = 0; i < s->audible_tracks; i++)
+    {
+      partial_t p;
+
+      p = s->tracks2[i];
+
+      if (!p->mask_valid)
+	mark_mask_dirty (s, f2B (p->f));
+      else if (mask_inputs_changed (p))
+	{
+	  mark_mask_dirty (s, p->mask_freqB);
+	  mark_mask_dirty (s, f2B (p->f));
+	  p->mask_valid = 0;
+	}
+    }
+
+  dirty = 0;
+  for (band = 0; band < MASK_BANDS; band++)
+    {
+      near[band] = 0;
+      dirty |= s->mask_dirty[band];
+    }
+
+  if (dirty)
+    {
+      /* Bands whose mask contributions may matter to the evaluated
+	 partials. */
+      for (band = 0; band < MASK_BANDS; band++)
+	if (s->mask_dirty[band])
+	  {
+	    int b;
+
+	    for (b = MAX (band - MASK_SPREAD_BANDS, 0);
+		 b <= MIN (band + MASK_SPREAD_BANDS, MASK_BANDS - 1);
+		 b++)
+	      near[b] = 1;
+	  }
+
+      reset_mask (s);
+
+      /* Move the partials to evaluate to the front of s->tracks2, and
+	 put the contributions of the others in the mask. */
+      evaluated = 0;
+      for (i = 0; i < s->audible_tracks; i++)
+	{
+	  partial_t p;
+
+	  p = s->tracks2[i];
+
+	  if (!p->mask_valid || s->mask_dirty[mask_band (p->mask_freqB)])
+	    {
+	      s->tracks2[i] = s->tracks2[evaluated];
+	      s->tracks2[evaluated++] = p;
+	    }
+	  else if (p->mask_contributes && near[mask_band (p->mask_freqB)])
+	    {
+	      masking_partial_t mp;
+
+	      mp = masking_partial_alloc (s, p);
+	      mp->freqB = p->mask_freqB;
+	      mp->min_vdB = p->mask_min_vdB;
+	      mp->max_vdB = p->mask_max_vdB;
+	      skip_list_insert (s->mask, mp);
+	    }
+	}
+
+      my_qsort (s->tracks2, evaluated, sizeof (partial_t),
+		compare_amplitudes);
+
+      for (i = 0; i < evaluated; i++)
+	{
+	  masking_partial_t mp;
+	  partial_t p;
+
+	  p = s->tracks2[i];
+
+	  p->masked = (add_partial_to_mask (s, p, &mp) == 0);
+	  p->mask_contributes = mp->in_mask;
+	  p->mask_valid = 1;
+	  p->mask_f = p->f;
+	  p->mask_a_left = p->a * partial_l_ratio (p);
+	  p->mask_a_right = p->a * partial_r_ratio (p);
+	  p->mask_freqB = mp->freqB;
+	  p->mask_min_vdB = mp->min_vdB;
+	  p->mask_max_vdB = mp->max_vdB;
+	}
+
+      for (band = 0; band < MASK_BANDS; band++)
+	s->mask_dirty[band] = 0;
+    }
+
+  /* Apply verdicts. */
+  s->masked_tracks = 0;
+
+  for (i = 0; i < s->audible_tracks; i++)
+    {
+      partial_t p;
+
+      p = s->tracks2[i];
+
+      if (p->masked)
+	{
+	  s->masked_tracks++;
+	  p->aenv[3] = BELOW_MIN_AMP;
+	}
+    }
+
+  s->audible_tracks -= s->masked_tracks;
+}
+
 #ifndef USE_RESONATOR
 
-/* Normal partial synthesis. */
+/* Oscillators are complex phasors (v1, v2) rotated by an increment
+   (r_inc, i_inc) at each sample.  Within a step, the frequency goes
+   linearly from the frequency at the beginning of the step to the one
+   at the beginning of the next step: the increment itself is rotated
+   at each sample by a small "chirp" rotation, computed without cos
+   and sin (see small_rotation).  The increment at the end of a step
+   is the one at the beginning of the next step, and is kept in the
+   partial from one block to the next, so that cos and sin are only
+   called when the increment has to be resynchronized: after a silent
+   step, or when the frequency jumped between blocks.  Steady or
+   gliding audible partials call neither.
+
+   Steps in which the chirp would change the phase by less than
+   PHASE_TOLERANCE are synthesized with constant frequency, and the
+   increment is rotated to the next frequency at the end of the step:
+   the second complex multiplication per sample is only spent on
+   partials that really glide.
+
+   Error budget with regard to the exact linear chirp: PHASE_TOLERANCE
+   radians per step for steps synthesized with constant frequency.
+   The numerical error of the chirp rotation is below 2e-11 per
+   sample for the fastest glide (Nyquist frequency in a step of
+   STEP_SAMPLES samples), that is less than 2e-8 radians of phase over
+   a block, and the magnitude of the increment is renormalized at the
+   end of each step.  With regard to the former synthesis with
+   constant frequency in each of the INTERPOLATION_STEPS steps, the
+   phase differs by at most (FREQCOEFF * STEP_SAMPLES / 2) times the
+   frequency change of each step, the amplitudes being the same. */
+
+/* Approximation of exp (i x) for small x, with Taylor polynomials.
+   For |x| < 0.05, the error is below 2e-11. */
+static inline void
+small_rotation (double x, double * r, double * i)
+{
+  double x2;
+
+  x2 = x * x;
+  *r = 1.0 - x2 * (0.5 - x2 * (1.0 / 24.0));
+  *i = x * (1.0 - x2 * ((1.0 / 6.0) - x2 * (1.0 / 120.0)));
+}
+
+/* Normal partial synthesis, over 'samples' samples, the frequency
+   going linearly from f to f_next.  The increment of the partial
+   should correspond to f. */
 static inline void
 partial_forward_synthesis (partial_t p,
 			   double a,
 			   double a_next,
 			   double f,
+			   double f_next,
+			   int samples,
 			   double * buffer)
 {
   int i;
-  double omega;
   double r_exp, i_exp;
   double r_inc, i_inc;
   double l_a, r_a;
@@ -832,141 +2277,1368 @@ partial_forward_synthesis (partial_t p,
   r_a = p->source->r_ratio * a;
 
   /* Linear increment between a and a_next. */
-  a_inc = (a_next - a) / STEP_SAMPLES;
+  a_inc = (a_next - a) / samples;
   l_a_inc = p->source->l_ratio * a_inc;
   r_a_inc = p->source->r_ratio * a_inc;
 
   r_exp = p->v1;
   i_exp = p->v2;
 
-  omega = FREQCOEFF * f;
+  r_inc = p->r_inc;
+  i_inc = p->i_inc;
 
-  r_inc = cos (omega);
-  i_inc = sin (omega);
+  if (fabs (f_next - f) * (0.5 * FREQCOEFF * samples) <= PHASE_TOLERANCE)
+    {
+      /* The chirp would not make a difference: constant frequency,
+	 then jump to f_next.  (Same for steady partials.) */
+      for (i = 0; i < samples; i++)
+	{
+	  double r;
+
+	  *buffer++ += l_a * i_exp;
+	  *buffer++ += r_a * i_exp;
+	  l_a += l_a_inc;
+	  r_a += r_a_inc;
+
+	  r = r_exp;
+	  r_exp = r * r_inc - i_exp * i_inc;
+	  i_exp = r * i_inc + i_exp * r_inc;
+	}
+
+      if (f_next != f)
+	{
+	  double r_jump, i_jump;
+	  double r;
+
+	  small_rotation (FREQCOEFF * (f_next - f), &r_jump, &i_jump);
 
-  for (i = 0; i < STEP_SAMPLES; i++)
+	  r = r_inc;
+	  r_inc = r * r_jump - i_inc * i_jump;
+	  i_inc = r * i_jump + i_inc * r_jump;
+	}
+    }
+  else
     {
-      double r;
+      double r_chirp, i_chirp;
+      double g;
 
-      *buffer++ += l_a * i_exp;
-      *buffer++ += r_a * i_exp;
-      l_a += l_a_inc;
-      r_a += r_a_inc;
+      small_rotation (FREQCOEFF * (f_next - f) / samples,
+		      &r_chirp, &i_chirp);
 
-      r = r_exp;
-      r_exp = r * r_inc - i_exp * i_inc;
-      i_exp = r * i_inc + i_exp * r_inc;
+      for (i = 0; i < samples; i++)
+	{
+	  double r;
+
+	  *buffer++ += l_a * i_exp;
+	  *buffer++ += r_a * i_exp;
+	  l_a += l_a_inc;
+	  r_a += r_a_inc;
+
+	  r = r_exp;
+	  r_exp = r * r_inc - i_exp * i_inc;
+	  i_exp = r * i_inc + i_exp * r_inc;
+
+	  r = r_inc;
+	  r_inc = r * r_chirp - i_inc * i_chirp;
+	  i_inc = r * i_chirp + i_inc * r_chirp;
+	}
+
+      /* Renormalize the increment (one Newton iteration towards
+	 1 / |inc|). */
+      g = 0.5 * (3.0 - (r_inc * r_inc + i_inc * i_inc));
+      r_inc *= g;
+      i_inc *= g;
     }
 
   p->v1 = r_exp;
   p->v2 = i_exp;
+  p->r_inc = r_inc;
+  p->i_inc = i_inc;
+  p->inc_f = f_next;
 }
 
-/* Fast forward in the case of a silent partial. */
+/* Same as partial_forward_synthesis, in binaural mode: each channel
+   takes both the sine and the cosine of the phase, with the gains and
+   phase offsets of the partial (see binaural_gains). */
 static inline void
-partial_fast_forward (partial_t p, double f)
+partial_binaural_forward_synthesis (partial_t p,
+				    double a,
+				    double a_next,
+				    double f,
+				    double f_next,
+				    int samples,
+				    double * buffer)
 {
-  double omega;
+  int i;
   double r_exp, i_exp;
   double r_inc, i_inc;
+  double a_inc;
+
+  /* Linear increment between a and a_next. */
+  a_inc = (a_next - a) / samples;
 
   r_exp = p->v1;
   i_exp = p->v2;
 
-  omega = (FREQCOEFF * STEP_SAMPLES) * f;
-
-  r_inc = cos (omega);
-  i_inc = sin (omega);
+  r_inc = p->r_inc;
+  i_inc = p->i_inc;
 
-  {
-    double r;
+  if (fabs (f_next - f) * (0.5 * FREQCOEFF * samples) <= PHASE_TOLERANCE)
+    {
+      for (i = 0; i < samples; i++)
+	{
+	  double r;
 
-    r = r_exp;
-    r_exp = r * r_inc - i_exp * i_inc;
-    i_exp = r * i_inc + i_exp * r_inc;
-  }
+	  *buffer++ += a * (p->l_sin * i_exp + p->l_cos * r_exp);
+	  *buffer++ += a * (p->r_sin * i_exp + p->r_cos * r_exp);
+	  a += a_inc;
 
-  p->v1 = r_exp;
-  p->v2 = i_exp;
-}
+	  r = r_exp;
+	  r_exp = r * r_inc - i_exp * i_inc;
+	  i_exp = r * i_inc + i_exp * r_inc;
+	}
 
-#else
+      if (f_next != f)
+	{
+	  double r_jump, i_jump;
+	  double r;
 
-/* Normal partial synthesis with resonator algorithm. */
-static inline void
-partial_forward_synthesis (partial_t p,
-			   double a,
-			   double a_next,
-			   double f,
-			   double * buffer)
-{
-  int i;
-  double fn;
-  double fn_1;
-  double c2;
-  double l_a, r_a;
-  double a_inc;
-  double l_a_inc, r_a_inc;
+	  small_rotation (FREQCOEFF * (f_next - f), &r_jump, &i_jump);
 
-  l_a = p->source->l_ratio * a;
-  r_a = p->source->r_ratio * a;
+	  r = r_inc;
+	  r_inc = r * r_jump - i_inc * i_jump;
+	  i_inc = r * i_jump + i_inc * r_jump;
+	}
+    }
+  else
+    {
+      double r_chirp, i_chirp;
+      double g;
 
-  /* Linear increment between a and a_next. */
-  a_inc = (a_next - a) / STEP_SAMPLES;
-  l_a_inc = p->source->l_ratio * a_inc;
-  r_a_inc = p->source->r_ratio * a_inc;
+      small_rotation (FREQCOEFF * (f_next - f) / samples,
+		      &r_chirp, &i_chirp);
 
-  fn = p->v1;
-  fn_1 = p->v2;
+      for (i = 0; i < samples; i++)
+	{
+	  double r;
 
-  c2 = 2.0 * cos (FREQCOEFF * f);
+	  *buffer++ += a * (p->l_sin * i_exp + p->l_cos * r_exp);
+	  *buffer++ += a * (p->r_sin * i_exp + p->r_cos * r_exp);
+	  a += a_inc;
 
-  for (i = 0; i < STEP_SAMPLES; i++)
-    {
-      double fnew;
+	  r = r_exp;
+	  r_exp = r * r_inc - i_exp * i_inc;
+	  i_exp = r * i_inc + i_exp * r_inc;
 
-      *buffer++ += l_a * fn;
-      *buffer++ += r_a * fn;
-      l_a += l_a_inc;
-      r_a += r_a_inc;
+	  r = r_inc;
+	  r_inc = r * r_chirp - i_inc * i_chirp;
+	  i_inc = r * i_chirp + i_inc * r_chirp;
+	}
 
-      fnew = fn * c2 - fn_1;
-      fn_1 = fn;
-      fn = fnew;
+      g = 0.5 * (3.0 - (r_inc * r_inc + i_inc * i_inc));
+      r_inc *= g;
+      i_inc *= g;
     }
 
-  p->v1 = fn;
-  p->v2 = fn_1;
+  p->v1 = r_exp;
+  p->v2 = i_exp;
+  p->r_inc = r_inc;
+  p->i_inc = i_inc;
+  p->inc_f = f_next;
 }
 
-/* Fast forward in the case of a silent partial (resonator version). */
+/* Rotates the phasor of a partial by 'phase' radians. */
 static inline void
-partial_fast_forward (partial_t p, double f)
+partial_rotate (partial_t p, double phase)
 {
-  int i;
-  double fn;
-  double fn_1;
-  double c2;
+  double r_exp, i_exp;
+  double r_rot, i_rot;
 
-  fn = p->v1;
-  fn_1 = p->v2;
+  r_exp = p->v1;
+  i_exp = p->v2;
 
-  c2 = 2.0 * cos (FREQCOEFF * f);
+  r_rot = cos (phase);
+  i_rot = sin (phase);
 
-  for (i = 0; i < STEP_SAMPLES; i++)
-    {
-      double fnew;
+  p->v1 = r_exp * r_rot - i_exp * i_rot;
+  p->v2 = r_exp * i_rot + i_exp * r_rot;
+}
 
-      fnew = fn * c2 - fn_1;
-      fn_1 = fn;
-      fn = fnew;
-    }
+/* Synthesis of a partial over a block, by steps of m interpolation
+   steps, given its INTERPOLATION_STEPS + 1 interpolated amplitudes
+   'inta' and frequencies 'intf'. */
+static inline void
+partial_synthesis (partial_t p,
+		   double * inta,
+		   double * intf,
+		   int m,
+		   double * buffer)
+{
+  int step;
+  int samples;
+  /* Phase advance of silent steps, not yet applied to the phasor. */
+  double pending;
+
+  samples = m * STEP_SAMPLES;
+  pending = p->pending_phase;
+
+  for (step = 0; step < INTERPOLATION_STEPS; step += m)
+    {
+      double a, a_next;
+      double f, f_next;
+
+      a = inta[step];
+      a_next = inta[step + m];
+      f = intf[step];
+      f_next = intf[step + m];
+
+      if (a < MIN_AMP && a_next < MIN_AMP)
+	/* Partial is not audible.  Don't fill buffer, but account for
+	   the phase advance (same chirp as when audible). */
+	pending += FREQCOEFF *
+	  (samples * f + 0.5 * (samples - 1) * (f_next - f));
+      else
+	{
+	  /* Partial is audible.  Fill buffer. */
+	  if (pending != 0.0)
+	    {
+	      partial_rotate (p, pending);
+	      pending = 0.0;
+	    }
+
+	  if (p->inc_f != f)
+	    {
+	      /* Resynchronize the increment. */
+	      p->r_inc = cos (FREQCOEFF * f);
+	      p->i_inc = sin (FREQCOEFF * f);
+	      p->inc_f = f;
+	    }
+
+	  if (p->source->binaural)
+	    partial_binaural_forward_synthesis (p, a, a_next, f, f_next,
+						samples,
+						buffer +
+						step * 2 * STEP_SAMPLES);
+	  else
+	    partial_forward_synthesis (p, a, a_next, f, f_next, samples,
+				       buffer + step * 2 * STEP_SAMPLES);
+	}
+    }
+
+  p->pending_phase = pending;
+}
+
+/* Returns 1 if a partial is silent during the whole block, 0
+   otherwise. */
+static inline int
+partial_is_silent (sas_synthesizer_t s, partial_t p)
+{
+  double a;
+
+  a = MAX (MAX (fabs (p->aenv[0]), fabs (p->aenv[1])),
+	   MAX (fabs (p->aenv[2]), fabs (p->aenv[3])));
+
+  return (a * s->amplitude_bound < MIN_AMP);
+}
+
+/* Skips a block for a silent partial: only the phase advance is
+   recorded, in closed form (integral of the interpolated frequency).
+   The phasor is rotated when the partial becomes audible again (see
+   partial_synthesis), so that silent and masked partials cost neither
+   cos nor sin, nor a pass over interpolation steps. */
+static inline void
+partial_skip (sas_synthesizer_t s, partial_t p)
+{
+  double phase;
+
+  phase = p->pending_phase + (FREQCOEFF * SAS_SAMPLES) *
+    (s->phase_coeffs[0] * p->fenv[0] +
+     s->phase_coeffs[1] * p->fenv[1] +
+     s->phase_coeffs[2] * p->fenv[2] +
+     s->phase_coeffs[3] * p->fenv[3]);
+
+  p->pending_phase = phase - (2.0 * M_PI) * floor (phase * (0.5 * M_1_PI));
+}
+
+/* Harmonic locking.  When the warp of a source is the identity, its
+   partials are the exact harmonics of the fundamental frequency.
+   Instead of rotating one phasor per partial, only the phasor of the
+   fundamental is rotated, and the sine of harmonic k is obtained by
+   the Chebyshev recurrence
+
+     sin (k x) = 2 cos (x) sin ((k - 1) x) - sin ((k - 2) x),
+
+   that is one multiply-add per harmonic and per sample, plus one for
+   its amplitude.  The stereo gains are applied once per sample to the
+   sum of harmonics.  The phases of harmonics are locked to the one
+   of the fundamental (harmonic k has phase k x).  Amplitudes go
+   through the normal birth, death and masking processes. */
+
+/* Makes the partials of a source synthesized from the fundamental
+   phasor, starting from the phase of the first harmonic. */
+static inline void
+lock_source (sas_source_t source)
+{
+  partial_t p;
+  double phi;
+
+  int i;
+
+  p = source->tracks;
+  phi = (p->link != NULL) ? atan2 (p->v2, p->v1) + p->pending_phase : 0.0;
+
+  source->v1 = cos (phi);
+  source->v2 = sin (phi);
+  source->locked = 1;
+
+  /* Phases jump: the reference synthesis starts again from them. */
+  for (i = 0; i < source->linked_tracks; i++)
+    source->tracks[i].reference_block = -1;
+}
+
+/* Gives back their own phasors to the partials of a source, with the
+   phases they had in the harmonic synthesis. */
+static inline void
+unlock_source (sas_source_t source)
+{
+  partial_t p;
+  double r_exp, i_exp;
+  int i;
+
+  r_exp = source->v1;
+  i_exp = source->v2;
+
+  for (i = 0, p = source->tracks; i < source->linked_tracks; i++, p++)
+    {
+      double r;
+
+      p->v1 = r_exp;
+      p->v2 = i_exp;
+      p->inc_f = -1.0;
+      p->pending_phase = 0.0;
+      p->reference_block = -1;
+
+      /* Phasor of next harmonic. */
+      r = r_exp;
+      r_exp = r * source->v1 - i_exp * source->v2;
+      i_exp = r * source->v2 + i_exp * source->v1;
+    }
+
+  source->locked = 0;
+}
+
+static inline void
+update_locking (sas_synthesizer_t s)
+{
+  sas_source_t source;
+
+  for (source = s->sources; source != NULL; source = source->next)
+    {
+      int lock;
+
+      /* The partials of a locked source share the gains of the
+	 source: no locking in binaural mode. */
+      lock = s->harmonic_locking && source->harmonic && !source->binaural;
+
+      if (lock && !source->locked)
+	lock_source (source);
+      else if (!lock && source->locked)
+	unlock_source (source);
+    }
+}
+
+/* Returns in (r_out, i_out) the k-th power (k >= 0) of the complex
+   number (r, i). */
+static inline void
+complex_power (double r, double i, int k, double * r_out, double * i_out)
+{
+  double r_res, i_res;
+
+  r_res = 1.0;
+  i_res = 0.0;
+
+  while (k > 0)
+    {
+      double t;
+
+      if (k & 1)
+	{
+	  t = r_res;
+	  r_res = t * r - i_res * i;
+	  i_res = t * i + i_res * r;
+	}
+
+      t = r;
+      r = t * t - i * i;
+      i = 2.0 * t * i;
+      k >>= 1;
+    }
+
+  *r_out = r_res;
+  *i_out = i_res;
+}
+
+/* Returns the number (at least 1) of harmonics, starting from
+   'first', whose amplitudes at both ends of a step ('a' and
+   'a_next') form geometric sequences of common ratio '*ratio'. */
+static inline int
+geometric_run (double * a, double * a_next, int first, int last,
+	       double * ratio)
+{
+  double r;
+  double w;
+  int j;
+
+  if (first + 1 >= last || a[first] + a_next[first] <= 0.0)
+    return 1;
+
+  r = (a[first + 1] + a_next[first + 1]) / (a[first] + a_next[first]);
+  if (r <= 0.0 || r > MAX_GROUP_RATIO)
+    return 1;
+
+  for (j = first + 1, w = r; j < last; j++, w *= r)
+    {
+      double pa, pa_next;
+
+      pa = w * a[first];
+      pa_next = w * a_next[first];
+
+      if (fabs (a[j] - pa) > GROUP_TOLERANCE * pa ||
+	  fabs (a_next[j] - pa_next) > GROUP_TOLERANCE * pa_next)
+	break;
+    }
+
+  *ratio = r;
+  return j - first;
+}
+
+/* Cuts the harmonics 0 to 'harmonics' - 1 of a step into segments.
+   Amplitudes at the start of the step are in 'amp', and amplitude
+   increments per sample in 'amp_inc'.  Returns the number of
+   segments. */
+static inline int
+make_segments (sas_synthesizer_t s, double * amp, double * amp_inc,
+	       int harmonics)
+{
+  harmonic_segment_t g;
+  int segments;
+  int i;
+
+  g = s->segments;
+  segments = 0;
+  i = 0;
+
+  while (i < harmonics)
+    {
+      double ratio;
+      int n;
+
+      n = geometric_run (amp, amp_inc, i, harmonics, &ratio);
+
+      if (n >= MIN_GROUP_HARMONICS)
+	{
+	  g[segments].first = i;
+	  g[segments].count = n;
+	  g[segments].group = 1;
+	  g[segments].ratio = ratio;
+	  g[segments].ratio_n = pow (ratio, n);
+	  g[segments].a = amp[i];
+	  g[segments].a_inc = (amp_inc[i] - amp[i]) / STEP_SAMPLES;
+	  segments++;
+	  i += n;
+	  continue;
+	}
+
+      /* Individual harmonics, merged with the previous ones if
+	 any. */
+      if (segments == 0 || g[segments - 1].group)
+	{
+	  g[segments].first = i;
+	  g[segments].count = 0;
+	  g[segments].group = 0;
+	  segments++;
+	}
+      g[segments - 1].count += n;
+      i += n;
+    }
+
+  /* Amplitudes of individual harmonics.  ('amp_inc' holds the
+     amplitudes at the end of the step until here.) */
+  for (i = 0; i < harmonics; i++)
+    amp_inc[i] = (amp_inc[i] - amp[i]) / STEP_SAMPLES;
+
+  return segments;
+}
+
+/* Phasor of harmonic k over a step, from the phasor of the
+   fundamental over the step ('fundamental', as (cos, sin) pairs). */
+static inline void
+harmonic_phasor (double * fundamental, int k,
+		 double * r, double * i, double * r_inc, double * i_inc)
+{
+  double r_end, i_end;
+
+  complex_power (fundamental[0], fundamental[1], k, r, i);
+  complex_power (fundamental[2], fundamental[3], k, &r_end, &i_end);
+
+  /* Increment = phasor (1) / phasor (0). */
+  *r_inc = r_end * *r + i_end * *i;
+  *i_inc = i_end * *r - r_end * *i;
+}
+
+/* Adds the individual harmonics of a segment to 'sums', over a
+   step. */
+static inline void
+harmonics_synthesis (harmonic_segment_t seg,
+		     double * amp, double * amp_inc,
+		     double * fundamental, double * sums)
+{
+  double * a;
+  double * a_inc;
+  double p1, p2, p1_inc, p2_inc;
+  int first, count;
+  int n;
+
+  first = seg->first;
+  count = seg->count;
+  a = amp + first;
+  a_inc = amp_inc + first;
+
+  if (first > 0)
+    harmonic_phasor (fundamental, first + 1,
+		     &p1, &p2, &p1_inc, &p2_inc);
+  else
+    p1 = p2 = p1_inc = p2_inc = 0.0;
+
+  for (n = 0; n < STEP_SAMPLES; n++)
+    {
+      double c2, s_prev, s_cur, s_next;
+      double sum;
+      double r;
+      int j;
+
+      /* sin ((k - 1) x) and sin (k x), k being the first harmonic of
+	 the segment. */
+      if (first > 0)
+	{
+	  s_prev = p2 * fundamental[2 * n] - p1 * fundamental[2 * n + 1];
+	  s_cur = p2;
+
+	  r = p1;
+	  p1 = r * p1_inc - p2 * p2_inc;
+	  p2 = r * p2_inc + p2 * p1_inc;
+	}
+      else
+	{
+	  s_prev = 0.0;
+	  s_cur = fundamental[2 * n + 1];
+	}
+      c2 = 2.0 * fundamental[2 * n];
+
+      sum = a[0] * s_cur;
+      a[0] += a_inc[0];
+
+      for (j = 1; j < count; j++)
+	{
+	  s_next = c2 * s_cur - s_prev;
+	  s_prev = s_cur;
+	  s_cur = s_next;
+	  sum += a[j] * s_cur;
+	  a[j] += a_inc[j];
+	}
+
+      sums[n] += sum;
+    }
+}
+
+/* Adds a group of harmonics to 'sums', over a step.  With x the phase
+   of the fundamental, and k the first harmonic of the group, the sum
+   of a * ratio ^ j * sin ((k + j) x) for j = 0 to count - 1 is the
+   imaginary part of
+
+     a * exp (i k x) * (1 - ratio ^ count * exp (i count x))
+       / (1 - ratio * exp (i x)),
+
+   which costs the rotation of 2 phasors per sample. */
+static inline void
+group_synthesis (harmonic_segment_t seg, double * fundamental,
+		 double * sums)
+{
+  double p1, p2, p1_inc, p2_inc;
+  double q1, q2, q1_inc, q2_inc;
+  double a, a_inc;
+  double ratio, ratio_n;
+  int count;
+  int n;
+
+  harmonic_phasor (fundamental, seg->first + 1, &p1, &p2, &p1_inc, &p2_inc);
+  harmonic_phasor (fundamental, seg->first + seg->count + 1,
+		   &q1, &q2, &q1_inc, &q2_inc);
+
+  a = seg->a;
+  a_inc = seg->a_inc;
+  ratio = seg->ratio;
+  ratio_n = seg->ratio_n;
+  count = seg->count;
+
+  for (n = 0; n < STEP_SAMPLES; n++)
+    {
+      double c, s;
+      double s_prev, s_cur;
+      double d;
+      double r;
+
+      c = fundamental[2 * n];
+      s = fundamental[2 * n + 1];
+
+      s_prev = p2 * c - p1 * s;
+      s_cur = p2;
+
+      d = 1.0 + ratio * (ratio - 2.0 * c);
+
+      if (d >= MIN_GROUP_DENOMINATOR)
+	sums[n] += a *
+	  (s_cur - ratio * s_prev -
+	   ratio_n * (q2 - ratio * (q2 * c - q1 * s))) / d;
+      else
+	{
+	  /* Near the pole of the formula, sum the harmonics. */
+	  double s_next;
+	  double w;
+	  int j;
+
+	  w = a;
+	  sums[n] += w * s_cur;
+
+	  for (j = 1; j < count; j++)
+	    {
+	      s_next = 2.0 * c * s_cur - s_prev;
+	      s_prev = s_cur;
+	      s_cur = s_next;
+	      w *= ratio;
+	      sums[n] += w * s_cur;
+	    }
+	}
+
+      a += a_inc;
+
+      r = p1;
+      p1 = r * p1_inc - p2 * p2_inc;
+      p2 = r * p2_inc + p2 * p1_inc;
+      r = q1;
+      q1 = r * q1_inc - q2 * q2_inc;
+      q2 = r * q2_inc + q2 * q1_inc;
+    }
+}
+
+/* Adds the harmonics 0 to 'harmonics' - 1 of a locked source to
+   'buffer', over a step, without harmonic groups: one recurrence over
+   all the harmonics at each sample, while the phasor of the
+   fundamental (*r_exp, *i_exp) turns by (r_inc, i_inc).  Amplitudes
+   at the start of the step are in 'amp', and increments per sample in
+   'amp_inc'. */
+static inline void
+locked_step_synthesis (sas_source_t source,
+		       double * amp, double * amp_inc, int harmonics,
+		       double * r_exp, double * i_exp,
+		       double r_inc, double i_inc,
+		       double * buffer)
+{
+  double r1, i1;
+  int i;
+  int n;
+
+  r1 = *r_exp;
+  i1 = *i_exp;
+
+  for (n = 0; n < STEP_SAMPLES; n++)
+    {
+      double c2;
+      double s_prev, s_cur, s_next;
+      double sum;
+      double r;
+
+      /* Harmonic 1. */
+      c2 = 2.0 * r1;
+      s_prev = 0.0;
+      s_cur = i1;
+      sum = amp[0] * s_cur;
+      amp[0] += amp_inc[0];
+
+      for (i = 1; i < harmonics; i++)
+	{
+	  s_next = c2 * s_cur - s_prev;
+	  s_prev = s_cur;
+	  s_cur = s_next;
+	  sum += amp[i] * s_cur;
+	  amp[i] += amp_inc[i];
+	}
+
+      *buffer++ += source->l_ratio * sum;
+      *buffer++ += source->r_ratio * sum;
+
+      r = r1;
+      r1 = r * r_inc - i1 * i_inc;
+      i1 = r * i_inc + i1 * r_inc;
+    }
+
+  *r_exp = r1;
+  *i_exp = i1;
+}
+
+static inline void
+synthesize_locked_source (sas_synthesizer_t s,
+			  sas_source_t source,
+			  double * buffer)
+{
+  double * amp;
+  double * amp_inc;
+  double r_exp, i_exp;
+  double g;
+  partial_t p;
+  int harmonics;
+  int step;
+  int i;
+
+  amp = s->locked_amplitudes;
+  amp_inc = s->locked_increments;
+
+  /* Harmonics above the last audible one are not synthesized. */
+  harmonics = 0;
+  for (i = 0, p = source->tracks; i < source->linked_tracks; i++, p++)
+    if (p->link != NULL && !partial_is_silent (s, p))
+      harmonics = i + 1;
+
+  r_exp = source->v1;
+  i_exp = source->v2;
+
+  for (step = 0; step < INTERPOLATION_STEPS; step++)
+    {
+      harmonic_segment_t seg;
+      double fundamental[2 * STEP_SAMPLES];
+      double sums[STEP_SAMPLES];
+      double f, f_next;
+      double r_inc, i_inc;
+      int segments;
+      int n;
+
+      f = (step == 0) ?
+	source->fenv[s->origin] :
+	interpolate_value (s, source->fenv, step);
+      f_next = (step == INTERPOLATION_STEPS - 1) ?
+	source->fenv[s->origin + 1] :
+	interpolate_value (s, source->fenv, step + 1);
+
+      /* Constant frequency over the step, with the phase advance of
+	 the chirp from f to f_next of unlocked partials (see
+	 partial_forward_synthesis), so that the phases do not drift
+	 apart when the frequency moves. */
+      f += (0.5 * (STEP_SAMPLES - 1) / STEP_SAMPLES) * (f_next - f);
+
+      if (harmonics == 0)
+	{
+	  /* Only keep the fundamental phasor going. */
+	  double r;
+
+	  r_inc = cos ((FREQCOEFF * STEP_SAMPLES) * f);
+	  i_inc = sin ((FREQCOEFF * STEP_SAMPLES) * f);
+
+	  r = r_exp;
+	  r_exp = r * r_inc - i_exp * i_inc;
+	  i_exp = r * i_inc + i_exp * r_inc;
+	  continue;
+	}
+
+      r_inc = cos (FREQCOEFF * f);
+      i_inc = sin (FREQCOEFF * f);
+
+      /* Amplitudes at both ends of the step ('amp_inc' temporarily
+	 holds the end values, see make_segments). */
+      for (i = 0, p = source->tracks; i < harmonics; i++, p++)
+	{
+	  double a, a_next;
+
+	  if (p->link == NULL)
+	    {
+	      amp[i] = amp_inc[i] = 0.0;
+	      continue;
+	    }
+
+	  a = (step == 0) ?
+	    p->aenv[s->origin] :
+	    interpolate_value (s, p->aenv, step);
+	  a_next = (step == INTERPOLATION_STEPS - 1) ?
+	    p->aenv[s->origin + 1] :
+	    interpolate_value (s, p->aenv, step + 1);
+
+	  if (a < MIN_AMP && a_next < MIN_AMP)
+	    /* Not audible. */
+	    a = a_next = 0.0;
+
+	  amp[i] = a;
+	  amp_inc[i] = a_next;
+	}
+
+      if (!s->harmonic_groups)
+	{
+	  /* No segments to find: the single recurrence is faster. */
+	  for (i = 0; i < harmonics; i++)
+	    amp_inc[i] = (amp_inc[i] - amp[i]) / STEP_SAMPLES;
+
+	  locked_step_synthesis (source, amp, amp_inc, harmonics,
+				 &r_exp, &i_exp, r_inc, i_inc, buffer);
+	  buffer += 2 * STEP_SAMPLES;
+	  continue;
+	}
+
+      segments = make_segments (s, amp, amp_inc, harmonics);
+
+      /* Fundamental phasor over the step. */
+      for (n = 0; n < STEP_SAMPLES; n++)
+	{
+	  double r;
+
+	  fundamental[2 * n] = r_exp;
+	  fundamental[2 * n + 1] = i_exp;
+	  sums[n] = 0.0;
+
+	  r = r_exp;
+	  r_exp = r * r_inc - i_exp * i_inc;
+	  i_exp = r * i_inc + i_exp * r_inc;
+	}
+
+      for (i = 0, seg = s->segments; i < segments; i++, seg++)
+	if (seg->group)
+	  group_synthesis (seg, fundamental, sums);
+	else
+	  harmonics_synthesis (seg, amp, amp_inc, fundamental, sums);
+
+      for (n = 0; n < STEP_SAMPLES; n++)
+	{
+	  *buffer++ += source->l_ratio * sums[n];
+	  *buffer++ += source->r_ratio * sums[n];
+	}
+    }
+
+  /* Renormalize the phasor. */
+  g = 0.5 * (3.0 - (r_exp * r_exp + i_exp * i_exp));
+  source->v1 = g * r_exp;
+  source->v2 = g * i_exp;
+}
+
+#else
+
+/* Normal partial synthesis with resonator algorithm. */
+static inline void
+partial_forward_synthesis (partial_t p,
+			   double a,
+			   double a_next,
+			   double f,
+			   int samples,
+			   double * buffer)
+{
+  int i;
+  double fn;
+  double fn_1;
+  double c2;
+  double l_a, r_a;
+  double a_inc;
+  double l_a_inc, r_a_inc;
+
+  l_a = p->source->l_ratio * a;
+  r_a = p->source->r_ratio * a;
+
+  /* Linear increment between a and a_next. */
+  a_inc = (a_next - a) / samples;
+  l_a_inc = p->source->l_ratio * a_inc;
+  r_a_inc = p->source->r_ratio * a_inc;
+
+  fn = p->v1;
+  fn_1 = p->v2;
+
+  c2 = 2.0 * cos (FREQCOEFF * f);
+
+  for (i = 0; i < samples; i++)
+    {
+      double fnew;
+
+      *buffer++ += l_a * fn;
+      *buffer++ += r_a * fn;
+      l_a += l_a_inc;
+      r_a += r_a_inc;
+
+      fnew = fn * c2 - fn_1;
+      fn_1 = fn;
+      fn = fnew;
+    }
+
+  p->v1 = fn;
+  p->v2 = fn_1;
+}
+
+/* Same as partial_forward_synthesis, in binaural mode (resonator
+   version).  The cosine of the phase is not at hand, but the
+   resonator holds sin (phi) and sin (phi - w): cos (phi) is (sin (phi)
+   cos (w) - sin (phi - w)) / sin (w). */
+static inline void
+partial_binaural_forward_synthesis (partial_t p,
+				    double a,
+				    double a_next,
+				    double f,
+				    int samples,
+				    double * buffer)
+{
+  int i;
+  double fn;
+  double fn_1;
+  double w;
+  double c2;
+  double l_0, l_1, r_0, r_1;
+  double a_inc;
+
+  /* Linear increment between a and a_next. */
+  a_inc = (a_next - a) / samples;
+
+  fn = p->v1;
+  fn_1 = p->v2;
+
+  w = FREQCOEFF * f;
+  c2 = 2.0 * cos (w);
+
+  /* Coefficients of sin (phi) and sin (phi - w) in each channel. */
+  l_0 = p->l_sin;
+  l_1 = 0.0;
+  r_0 = p->r_sin;
+  r_1 = 0.0;
+  if (fabs (sin (w)) > 1e-9)
+    {
+      double cotan, cosec;
+
+      cotan = cos (w) / sin (w);
+      cosec = 1.0 / sin (w);
+
+      l_0 += p->l_cos * cotan;
+      l_1 = - p->l_cos * cosec;
+      r_0 += p->r_cos * cotan;
+      r_1 = - p->r_cos * cosec;
+    }
+
+  for (i = 0; i < samples; i++)
+    {
+      double fnew;
+
+      *buffer++ += a * (l_0 * fn + l_1 * fn_1);
+      *buffer++ += a * (r_0 * fn + r_1 * fn_1);
+      a += a_inc;
+
+      fnew = fn * c2 - fn_1;
+      fn_1 = fn;
+      fn = fnew;
+    }
+
+  p->v1 = fn;
+  p->v2 = fn_1;
+}
+
+/* Fast forward in the case of a silent partial (resonator version). */
+static inline void
+partial_fast_forward (partial_t p, double f, int samples)
+{
+  int i;
+  double fn;
+  double fn_1;
+  double c2;
+
+  fn = p->v1;
+  fn_1 = p->v2;
+
+  c2 = 2.0 * cos (FREQCOEFF * f);
+
+  for (i = 0; i < samples; i++)
+    {
+      double fnew;
+
+      fnew = fn * c2 - fn_1;
+      fn_1 = fn;
+      fn = fnew;
+    }
+
+  p->v1 = fn;
+  p->v2 = fn_1;
+}
+
+/* Synthesis of a partial over a block (resonator version). */
+static inline void
+partial_synthesis (partial_t p,
+		   double * inta,
+		   double * intf,
+		   int m,
+		   double * buffer)
+{
+  int step;
+
+  for (step = 0; step < INTERPOLATION_STEPS; step += m)
+    {
+      double a, a_next;
+      double f;
+
+      a = inta[step];
+      a_next = inta[step + m];
+      f = intf[step];
+
+      if (a < MIN_AMP && a_next < MIN_AMP)
+	/* Partial is not audible.  Don't fill buffer, but update
+	   parameters. */
+	partial_fast_forward (p, f, m * STEP_SAMPLES);
+      else
+	/* Partial is audible.  Fill buffer. */
+	if (p->source->binaural)
+	  partial_binaural_forward_synthesis (p, a, a_next, f,
+					      m * STEP_SAMPLES,
+					      buffer + step * 2 * STEP_SAMPLES);
+	else
+	  partial_forward_synthesis (p, a, a_next, f, m * STEP_SAMPLES,
+				     buffer + step * 2 * STEP_SAMPLES);
+    }
+}
+
+#endif
+
+/* Returns the number of steps (a divisor of INTERPOLATION_STEPS) that
+   are enough to synthesize a partial, given its INTERPOLATION_STEPS +
+   1 interpolated amplitudes 'inta' and frequencies 'intf'.  A partial
+   with steady (or linearly gliding) frequency and amplitude can be
+   synthesized in one long step, saving the setup of each step.  The phase drift and
+   amplitude error with regard to a synthesis with
+   INTERPOLATION_STEPS steps are kept under PHASE_TOLERANCE and
+   AMPLITUDE_TOLERANCE. */
+static inline int
+interpolation_steps (double * inta, double * intf)
+{
+  int steps;
+
+  for (steps = 1; steps < INTERPOLATION_STEPS; steps *= 2)
+    {
+      int m;
+      int k;
+      double drift;
+
+      /* Number of fine steps in a coarse step. */
+      m = INTERPOLATION_STEPS / steps;
+
+      drift = 0.0;
+
+      for (k = 0; k < INTERPOLATION_STEPS; k++)
+	{
+	  int k0;
+	  double a;
+
+	  /* First fine step of the coarse step. */
+	  k0 = k - (k % m);
+
+	  /* Amplitudes are linear in a coarse step. */
+	  a = inta[k0] + (inta[k0 + m] - inta[k0]) * (k % m) / m;
+
+#ifndef USE_RESONATOR
+	  /* So are frequencies (chirps, see partial_forward_synthesis):
+	     compare average frequencies over the fine step. */
+	  drift += 0.5 * (intf[k] + intf[k + 1]) -
+	    intf[k0] - (intf[k0 + m] - intf[k0]) * ((k % m) + 0.5) / m;
+#else
+	  /* Frequency is the one of the first fine step. */
+	  drift += intf[k] - intf[k0];
+#endif
+
+	  if ((fabs (inta[k] - a) > AMPLITUDE_TOLERANCE) ||
+	      (fabs (drift) * (FREQCOEFF * STEP_SAMPLES) > PHASE_TOLERANCE))
+	    break;
+	}
+
+      if (k == INTERPOLATION_STEPS)
+	return steps;
+    }
+
+  return INTERPOLATION_STEPS;
+}
+
+/* Computes the INTERPOLATION_STEPS + 1 values of amplitude and
+   frequency of a partial over the block. */
+static inline void
+partial_interpolate (sas_synthesizer_t s, partial_t p,
+		     double * inta, double * intf)
+{
+  int step;
+
+  inta[0] = p->aenv[s->origin];
+  intf[0] = p->fenv[s->origin];
+
+  /* FIXME: does the compiler use pipelining features of the CPU?  */
+  for (step = 1; step < INTERPOLATION_STEPS; step++)
+    {
+      inta[step] = interpolate_value (s, p->aenv, step);
+      intf[step] = interpolate_value (s, p->fenv, step);
+    }
+
+  inta[INTERPOLATION_STEPS] = p->aenv[s->origin + 1];
+  intf[INTERPOLATION_STEPS] = p->fenv[s->origin + 1];
+}
+
+/* Phase of a partial at the start of the block, as left by the
+   synthesis of the previous block. */
+static inline double
+partial_phase (sas_synthesizer_t s, partial_t p)
+{
+#ifndef USE_RESONATOR
+  (void) s;  /* Only the resonator needs the interpolation origin. */
+
+  if (p->source->locked)
+    /* Harmonic k has k times the phase of the fundamental. */
+    return (p - p->source->tracks + 1) *
+      atan2 (p->source->v2, p->source->v1);
+
+  return atan2 (p->v2, p->v1) + p->pending_phase;
+#else
+  /* The resonator holds sin (phi) and sin (phi - w). */
+  double w;
+
+  w = FREQCOEFF * p->fenv[s->origin];
+  return atan2 (p->v1, (p->v1 * cos (w) - p->v2) / sin (w));
+#endif
+}
+
+/* Reference synthesis of the partials of the block, for accuracy
+   checks of the faster synthesis paths (see
+   sas_synthesizer_synthesize_reference).  Each partial is summed
+   sample by sample with sin, over the INTERPOLATION_STEPS steps, its
+   amplitude and frequency going linearly between interpolation
+   points, and its phase being the exact integral of its frequency
+   since the last time it was synthesized this way.  Only the phase a
+   partial starts with is taken from the fast synthesis. */
+static inline void
+reference_synthesis (sas_synthesizer_t s, double * buffer)
+{
+  partial_t * src;
+  int i;
+
+  for (i = 0; i < 2 * SAS_SAMPLES; i++)
+    buffer[i] = 0.0;
+
+  for (i = 0, src = s->tracks; i < s->active_tracks; i++, src++)
+    {
+      partial_t p;
+      double inta[INTERPOLATION_STEPS + 1];
+      double intf[INTERPOLATION_STEPS + 1];
+      double phase;
+      double * out;
+      int step;
+
+      p = *src;
+
+      partial_interpolate (s, p, inta, intf);
+
+      phase = (p->reference_block >= 0 &&
+	       p->reference_block == s->blocks - 1) ?
+	p->reference_phase :
+	partial_phase (s, p);
+
+      out = buffer;
+
+      for (step = 0; step < INTERPOLATION_STEPS; step++)
+	{
+	  double a, a_next;
+	  double f, f_next;
+	  int n;
+
+	  a = inta[step];
+	  a_next = inta[step + 1];
+	  f = intf[step];
+	  f_next = intf[step + 1];
+
+	  if (a >= MIN_AMP || a_next >= MIN_AMP)
+	    for (n = 0; n < STEP_SAMPLES; n++)
+	      {
+		double x, y;
+		double phi;
+
+		x = (a + (a_next - a) * n / STEP_SAMPLES);
+		phi = phase + FREQCOEFF *
+		  (f * n + 0.5 * (f_next - f) * n * (n - 1) / STEP_SAMPLES);
+
+		if (p->source->binaural)
+		  {
+		    y = x * cos (phi);
+		    x *= sin (phi);
+		    out[2 * n] += p->l_sin * x + p->l_cos * y;
+		    out[2 * n + 1] += p->r_sin * x + p->r_cos * y;
+		  }
+		else
+		  {
+		    x *= sin (phi);
+		    out[2 * n] += p->source->l_ratio * x;
+		    out[2 * n + 1] += p->source->r_ratio * x;
+		  }
+	      }
 
-  p->v1 = fn;
-  p->v2 = fn_1;
+	  out += 2 * STEP_SAMPLES;
+
+	  phase += FREQCOEFF *
+	    (STEP_SAMPLES * f + 0.5 * (STEP_SAMPLES - 1) * (f_next - f));
+	}
+
+      p->reference_phase = fmod (phase, 2.0 * M_PI);
+      p->reference_block = s->blocks;
+    }
 }
 
-#endif
+/* Adds the noise of the sources to 'buffer', and to 'reference' if
+   not NULL.  Noise frames are made in the frequency domain, from the
+   power spectra of the sources with random phases, and brought back
+   to time by one inverse FFT for both channels.  The frames are sine
+   windowed and overlapped by half, which keeps the power of the noise
+   constant.  The bins of the right channel are drawn with regard to
+   the ones of the left channel and to the cross spectrum, so that the
+   noise of a source is as correlated between the channels as its
+   panning says.  The first frame of a block is made from the mean of
+   the spectra of the previous and current blocks. */
+static inline void
+noise_synthesis (sas_synthesizer_t s, double * buffer, double * reference)
+{
+  double * previous[3];
+  double * current[3];
+  sas_source_t source;
+  int noisy;
+  int hop;
+  int k;
+  int n;
+
+  s->noise_current = 1 - s->noise_current;
+
+  for (k = 0; k < 3; k++)
+    {
+      previous[k] = s->noise_power[1 - s->noise_current][k];
+      current[k] = s->noise_power[s->noise_current][k];
+    }
+
+  for (k = 0; k < NOISE_BINS; k++)
+    current[0][k] = current[1][k] = current[2][k] = 0.0;
+
+  noisy = 0;
+
+  for (source = s->sources; source != NULL; source = source->next)
+    if (source->noisy)
+      {
+	double l2, r2, lr;
+
+	l2 = SQR (source->l_ratio);
+	r2 = SQR (source->r_ratio);
+	lr = source->l_ratio * source->r_ratio;
+
+	for (k = 0; k < NOISE_BINS; k++)
+	  {
+	    current[0][k] += l2 * source->noise_power[k];
+	    current[1][k] += r2 * source->noise_power[k];
+	    current[2][k] += lr * source->noise_power[k];
+	  }
+
+	noisy = 1;
+      }
+
+  if (!noisy && !s->noisy)
+    /* Silence, and nothing left of the last frame. */
+    return;
+
+  for (hop = 0; hop < SAS_SAMPLES / NOISE_HOP; hop++)
+    {
+      double re[NOISE_SIZE];
+      double im[NOISE_SIZE];
+      int offset;
+
+      re[0] = im[0] = 0.0;
+      re[NOISE_SIZE / 2] = im[NOISE_SIZE / 2] = 0.0;
+
+      for (k = 0; k < NOISE_BINS; k++)
+	{
+	  double pl, pr, plr;
+	  double a, b, c;
+	  double phi1, phi2;
+	  double lre, lim, rre, rim;
+
+	  if (hop == 0)
+	    {
+	      pl = 0.5 * (previous[0][k] + current[0][k]);
+	      pr = 0.5 * (previous[1][k] + current[1][k]);
+	      plr = 0.5 * (previous[2][k] + current[2][k]);
+	    }
+	  else
+	    {
+	      pl = current[0][k];
+	      pr = current[1][k];
+	      plr = current[2][k];
+	    }
+
+	  /* L = a z1 and R = b z1 + c z2, for independent random
+	     phasors z1 and z2: |L|^2 = pl, |R|^2 = pr, and L R* = plr
+	     on average. */
+	  if (pl > 0.0)
+	    {
+	      a = sqrt (pl);
+	      b = plr / a;
+	      c = sqrt (MAX (pr - b * b, 0.0));
+	    }
+	  else
+	    {
+	      a = 0.0;
+	      b = 0.0;
+	      c = sqrt (pr);
+	    }
+
+	  phi1 = random_phase (s);
+	  phi2 = random_phase (s);
+
+	  lre = a * cos (phi1);
+	  lim = a * sin (phi1);
+	  rre = b * cos (phi1) + c * cos (phi2);
+	  rim = b * sin (phi1) + c * sin (phi2);
+
+	  /* Both channels in one transform: Z(k) = L(k) + i R(k), and
+	     Z(N - k) = L(k)* + i R(k)*, so that the real part of the
+	     inverse transform is the left channel and its imaginary
+	     part is the right channel. */
+	  re[k + 1] = lre - rim;
+	  im[k + 1] = lim + rre;
+	  re[NOISE_SIZE - k - 1] = lre + rim;
+	  im[NOISE_SIZE - k - 1] = rre - lim;
+	}
+
+      sas_fft (re, im, NOISE_SIZE, 1);
+
+      offset = 2 * hop * NOISE_HOP;
+
+      for (n = 0; n < NOISE_HOP; n++)
+	{
+	  double w1, w2;
+	  double l, r;
+
+	  w1 = s->noise_window[n];
+	  w2 = s->noise_window[n + NOISE_HOP];
+
+	  l = s->noise_overlap[2 * n] + w1 * re[n];
+	  r = s->noise_overlap[2 * n + 1] + w1 * im[n];
+	  s->noise_overlap[2 * n] = w2 * re[n + NOISE_HOP];
+	  s->noise_overlap[2 * n + 1] = w2 * im[n + NOISE_HOP];
+
+	  buffer[offset + 2 * n] += l;
+	  buffer[offset + 2 * n + 1] += r;
+	  if (reference != NULL)
+	    {
+	      reference[offset + 2 * n] += l;
+	      reference[offset + 2 * n + 1] += r;
+	    }
+	}
+    }
+
+  s->noisy = noisy;
+}
 
 /*======================================================================*/
 /* Interface */
@@ -975,36 +3647,511 @@ sas_synthesizer_t
 sas_synthesizer_make (void)
 {
   sas_synthesizer_t s;
-  int step;
+  struct timeval tv;
+  int i;
 
   s = (sas_synthesizer_t) malloc (sizeof (struct sas_synthesizer_s));
   assert (s);
 
-  s->sources = NULL;
-  s->number_of_sources = 0;
-  s->amplitude_factor = 0.0;
+  s->sources = NULL;
+  s->number_of_sources = 0;
+  s->number_of_made_sources = 0;
+  s->trace = NULL;
+  s->amplitude_factor = 0.0;
+
+  s->allocated = MAX_PARTIALS_PER_SYNTH;
+  s->tracks = (partial_t *) malloc (s->allocated * sizeof (partial_t));
+  assert (s->tracks);
+
+  s->active_tracks = 0;
+  s->masked_tracks = 0;
+  s->audible_tracks = 0;
+
+  s->threshold = sas_envelope_amplitude_threshold ();
+
+  s->tracks2 =  (partial_t *) malloc (s->allocated * sizeof (partial_t));
+  assert (s->tracks2);
+
+  s->tapped = (partial_t *) malloc (s->allocated * sizeof (partial_t));
+  assert (s->tapped);
+
+  /* Seeded again with the synthesizer, below. */
+  s->mask = skip_list_make (compare_frequencies, 1);
+  s->incremental_masking = 0;
+
+  s->block = (double *) malloc (2 * SAS_SAMPLES * sizeof (double));
+  assert (s->block);
+  s->block_position = SAS_SAMPLES;
+
+#ifdef _REENTRANT
+  s->workers = NULL;
+  s->number_of_workers = 0;
+  pthread_mutex_init (&s->work_lock, NULL);
+  pthread_cond_init (&s->work_start, NULL);
+  pthread_cond_init (&s->work_done, NULL);
+  s->generation = 0;
+  s->pending_workers = 0;
+  s->quit = 0;
+  s->source_array = NULL;
+  s->source_array_size = 0;
+  s->number_of_scanned_sources = 0;
+  s->next_source = 0;
+#endif
+
+  s->pool = (pool_of_masking_partials_t)
+    malloc (sizeof (struct pool_of_masking_partials_s));
+  s->pool->allocated = MAX_PARTIALS_PER_SYNTH;
+  s->pool->partials = (masking_partial_t)
+    malloc (s->pool->allocated * sizeof (struct masking_partial_s));
+  s->pool->used = 0;
+
+  s->origin = 1;
+  sas_synthesizer_set_interpolation (s, SAS_INTERPOLATION_SMOOTH);
+
+  s->harmonic_locking = 0;
+  s->harmonic_groups = 0;
+  s->hrtf = NULL;
+  s->locked_amplitudes = (double *)
+    malloc (MAX_PARTIALS_PER_SOURCE * sizeof (double));
+  assert (s->locked_amplitudes);
+  s->locked_increments = (double *)
+    malloc (MAX_PARTIALS_PER_SOURCE * sizeof (double));
+  assert (s->locked_increments);
+  s->segments = (harmonic_segment_t)
+    malloc (MAX_PARTIALS_PER_SOURCE * sizeof (struct harmonic_segment_s));
+  assert (s->segments);
+
+  gettimeofday (&tv, NULL);
+  sas_synthesizer_set_seed (s, tv.tv_sec ^ tv.tv_usec);
+  s->blocks = 0;
+
+  for (i = 0; i < NOISE_BINS; i++)
+    s->noise_power[0][0][i] = s->noise_power[0][1][i] =
+      s->noise_power[0][2][i] = 0.0;
+  s->noise_current = 0;
+  s->noisy = 0;
+  for (i = 0; i < NOISE_SIZE; i++)
+    s->noise_window[i] = sin (M_PI * (i + 0.5) / NOISE_SIZE);
+  for (i = 0; i < 2 * NOISE_HOP; i++)
+    s->noise_overlap[i] = 0.0;
+
+  for (i = 0; i < SCAN_CACHE_SIZE; i++)
+    {
+      harmonic_scan_t scan;
+
+      scan = s->scan_cache + i;
+      scan->block = -1;
+      scan->ready = 0;
+      /* Allocated here rather than in the synthesis thread. */
+      scan->f = (double *)
+	malloc (3 * MAX_PARTIALS_PER_SOURCE * sizeof (double));
+      assert (scan->f);
+      scan->c = scan->f + MAX_PARTIALS_PER_SOURCE;
+      scan->threshold = scan->c + MAX_PARTIALS_PER_SOURCE;
+    }
+  s->shared_scans = 0;
+#ifdef _REENTRANT
+  pthread_mutex_init (&s->scan_cache_lock, NULL);
+#endif
+
+  for (i = 0; i < SAS_RT_EVENTS; i++)
+    s->rt_events[i] = 0;
+
+  return s;
+}
+
+void
+sas_synthesizer_free (sas_synthesizer_t s)
+{
+  int i;
+
+  assert (s);
+
+#ifdef _REENTRANT
+  stop_workers (s);
+  pthread_mutex_destroy (&s->work_lock);
+  pthread_cond_destroy (&s->work_start);
+  pthread_cond_destroy (&s->work_done);
+  pthread_mutex_destroy (&s->scan_cache_lock);
+  free (s->source_array);
+#endif
+
+  while (s->sources != NULL)
+    sas_synthesizer_source_delayed_free (s, s->sources);
+
+  free (s->tracks);
+  free (s->tracks2);
+  free (s->tapped);
+  skip_list_free (s->mask);
+  free (s->pool->partials);
+  free (s->pool);
+  free (s->locked_amplitudes);
+  free (s->locked_increments);
+  free (s->segments);
+  free (s->block);
+  for (i = 0; i < SCAN_CACHE_SIZE; i++)
+    free (s->scan_cache[i].f);
+  free (s);
+}
+
+sas_source_t
+sas_synthesizer_source_make (sas_synthesizer_t s,
+			     sas_position_t pos,
+			     sas_update_callback_t update,
+			     void * call_data)
+{
+  sas_source_t source;
+  int i;
+
+  assert (s);
+  assert (pos);
+  assert (update == NULL || call_data);
+
+  source = (sas_source_t) malloc (sizeof (struct sas_source_s));
+  assert (source);
+
+  source->update = update;
+  source->call_data = call_data;
+  source->pushed = 0;
+  source->updated = 0;
+  source->number = s->number_of_made_sources++;
+
+  source->propagated_frames = (sas_frame_t *)
+    malloc (MAX_PROPAGATED_FRAMES * sizeof (sas_frame_t));
+  assert (source->propagated_frames);
+
+  for (i = 0; i < MAX_PROPAGATED_FRAMES; i++)
+    source->propagated_frames[i] = sas_frame_make ();
+
+  source->emission_index = 0;
+  source->given_index = 0;
+
+  source->position.x = pos->x;
+  source->position.y = pos->y;
+  source->position.z = pos->z;
+
+  source->f = 440.0;
+  source->fenv[0] = source->fenv[1] = source->fenv[2] = source->fenv[3] =
+    source->f;
+  source->harmonic = 0;
+  source->locked = 0;
+  source->binaural = 0;
+  source->v1 = 1.0;
+  source->v2 = 0.0;
+  source->noise_power = NULL;
+  source->noisy = 0;
+  source->raw_partials = -1;
+  source->raw_allocated = 0;
+  source->raw_frequencies = NULL;
+  source->raw_amplitudes = NULL;
+
+  source->queue = NULL;
+  source->queue_size = 0;
+  source->queue_head = 0;
+  source->queue_tail = 0;
+
+  reset_source_spatial_information (source);
+
+  /* All the frames are silent: asleep from the start. */
+  source->silent_blocks = MAX_PROPAGATED_FRAMES;
+  source->dormant = 1;
+
+  source->tracks = NULL;
+  source->allocated_tracks = 0;
+  source->wanted_tracks = 0;
+  grow_tracks (source, MIN_PARTIALS_PER_SOURCE);
+
+  source->active_tracks = 0;
+  source->linked_tracks = 0;
+
+  source->next = s->sources;
+  s->sources = source;
+
+  source->delayed_free = 0;
+
+  s->number_of_sources++;
+  s->amplitude_factor =
+    1.0 / ((log (s->number_of_sources) * (1.0 / M_LN2)) + 1.0);
+
+  if (s->trace != NULL)
+    sas_trace_write_make (s->trace, source->number, &source->position);
+
+#ifdef _REENTRANT
+  if (s->number_of_sources > s->source_array_size)
+    {
+      s->source_array_size = 2 * s->number_of_sources;
+      s->source_array = (sas_source_t *)
+	realloc (s->source_array,
+		 s->source_array_size * sizeof (sas_source_t));
+      assert (s->source_array);
+    }
+#endif
+
+  return source;
+}
+
+void
+sas_synthesizer_bulk_update (sas_synthesizer_t s,
+			     int n,
+			     sas_source_t * sources,
+			     double * amplitudes,
+			     double * frequencies,
+			     sas_envelope_t * colors,
+			     sas_envelope_t * warps,
+			     sas_envelope_t * noises,
+			     struct sas_position_s * positions)
+{
+  int i;
+
+  assert (s);
+  assert (n == 0 || (sources && amplitudes && frequencies));
+
+  for (i = 0; i < n; i++)
+    {
+      sas_source_t source;
+      sas_frame_t frame;
+      sas_frame_t previous;
+
+      source = sources[i];
+      assert (source->update == NULL);
+
+      /* Write directly into the emission point, where an update
+	 callback would have its frame copied. */
+      frame = source->propagated_frames[source->emission_index];
+
+      /* The emission point still holds the frame emitted
+	 MAX_PROPAGATED_FRAMES blocks ago: the envelopes kept come
+	 from the frame given last, which is not in the previous entry
+	 if the source was frozen since. */
+      previous = source->propagated_frames[source->given_index];
+
+      sas_frame_set_amplitude (frame, amplitudes[i]);
+      sas_frame_set_frequency (frame, frequencies[i]);
+      sas_frame_set_color (frame,
+			   (colors != NULL) ?
+			   colors[i] : sas_frame_get_color (previous));
+      sas_frame_set_warp (frame,
+			  (warps != NULL) ?
+			  warps[i] : sas_frame_get_warp (previous));
+      sas_frame_set_noise (frame,
+			   (noises != NULL) ?
+			   noises[i] : sas_frame_get_noise (previous));
+
+      if (positions != NULL)
+	source->position = positions[i];
+
+      source->given_index = source->emission_index;
+      source->raw_partials = -1;
+      source->pushed = 1;
+    }
+}
+
+void
+sas_synthesizer_source_set_partials (sas_synthesizer_t s,
+				     sas_source_t source,
+				     int n,
+				     double * frequencies,
+				     double * amplitudes,
+				     sas_position_t pos)
+{
+  int i;
+
+  assert (s);
+  assert (source);
+  assert (source->update == NULL);
+  assert (n == 0 || (frequencies && amplitudes));
+
+  n = MIN (MAX (n, 0), MAX_PARTIALS_PER_SOURCE);
+
+  if (n > source->raw_allocated)
+    {
+      source->raw_allocated = MAX (n, 2 * source->raw_allocated);
+      source->raw_frequencies = (double *)
+	realloc (source->raw_frequencies,
+		 source->raw_allocated * sizeof (double));
+      source->raw_amplitudes = (double *)
+	realloc (source->raw_amplitudes,
+		 source->raw_allocated * sizeof (double));
+      assert (source->raw_frequencies && source->raw_amplitudes);
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      source->raw_frequencies[i] = frequencies[i];
+      source->raw_amplitudes[i] = amplitudes[i];
+    }
+  source->raw_partials = n;
+
+  if (pos != NULL)
+    source->position = *pos;
+
+  source->pushed = 1;
+}
+
+void
+sas_synthesizer_source_queue (sas_synthesizer_t s,
+			      sas_source_t source,
+			      int size)
+{
+  int i;
+
+  assert (s);
+  assert (source);
+  assert (source->update == NULL);
+  assert (source->queue == NULL);
+  assert (size > 0);
+
+  source->queue = (queued_frame_t)
+    malloc (size * sizeof (struct queued_frame_s));
+  assert (source->queue);
+
+  for (i = 0; i < size; i++)
+    source->queue[i].frame = sas_frame_make ();
+
+  source->queue_size = size;
+  source->queue_head = 0;
+  source->queue_tail = 0;
+}
+
+int
+sas_synthesizer_source_push (sas_synthesizer_t s,
+			     sas_source_t source,
+			     double time,
+			     sas_frame_t frame,
+			     sas_position_t pos)
+{
+  queued_frame_t entry;
+  unsigned int head;
+
+  assert (s);
+  assert (source);
+  assert (source->queue);
+  assert (frame);
+
+  head = source->queue_head;
+
+  if (head - SAS_ATOMIC_LOAD (source->queue_tail) >= source->queue_size)
+    /* Full. */
+    return 0;
+
+  entry = source->queue + (head % source->queue_size);
+  entry->time = time;
+  sas_frame_copy (entry->frame, frame);
+  entry->moved = (pos != NULL);
+  if (pos != NULL)
+    entry->position = *pos;
+
+  SAS_ATOMIC_STORE (source->queue_head, head + 1);
+
+  return 1;
+}
+
+double
+sas_synthesizer_get_time (sas_synthesizer_t s)
+{
+  assert (s);
+
+  return block_time (SAS_ATOMIC_LOAD (s->blocks));
+}
+
+void
+sas_synthesizer_source_free (sas_synthesizer_t s, sas_source_t source)
+{
+  assert (s);
+  assert (source);
+  assert (source->delayed_free == 0);
+
+  if (s->trace != NULL)
+    sas_trace_write_free (s->trace, source->number);
+
+  if (source->linked_tracks == 0)
+    sas_synthesizer_source_delayed_free (s, source);
+  else
+    {
+      /* The source still has active partials in synthesizer.  Program
+         the mute of partials and the source deletion in the future. */
+      int i;
+
+      for (i = 0; i < MAX_PROPAGATED_FRAMES; i++)
+	sas_frame_set_amplitude (source->propagated_frames[i], 0.0);
+
+      source->delayed_free = 1;
+    }
+}
+
+void
+sas_synthesizer_record (sas_synthesizer_t s, sas_trace_t t)
+{
+  sas_source_t source;
+  sas_source_t * sources;
+  int n;
+
+  assert (s);
+
+  s->trace = t;
+
+  if (t == NULL)
+    return;
+
+  /* Record the sources already there, oldest first, so that they are
+     made in the same order when replaying. */
+  sources = (sas_source_t *)
+    malloc ((s->number_of_sources + 1) * sizeof (sas_source_t));
+  assert (sources);
+
+  n = 0;
+  for (source = s->sources; source != NULL; source = source->next)
+    if (!source->delayed_free)
+      sources[n++] = source;
+
+  while (n > 0)
+    {
+      source = sources[--n];
+      sas_trace_write_make (t, source->number, &source->position);
+    }
+
+  free (sources);
+}
+
+/* Moves the interpolation envelopes of the partials and sources
+   after a change of the interpolation origin from 'previous' to
+   s->origin, so that the next block starts from the values the last
+   one ended with (at point 'previous' + 1, which becomes point
+   'previous' when the next frame is shifted in).  With less latency,
+   the frame not yet reached is dropped, and with more latency, the
+   last values are held for one more block. */
+static void
+reseed_envelopes (sas_synthesizer_t s, int previous)
+{
+  sas_source_t source;
+  int i;
 
-  s->allocated = MAX_PARTIALS_PER_SYNTH;
-  s->tracks = (partial_t *) malloc (s->allocated * sizeof (partial_t));
-  assert (s->tracks);
+  for (source = s->sources; source != NULL; source = source->next)
+    {
+      source->fenv[s->origin + 1] = source->fenv[previous + 1];
 
-  s->active_tracks = 0;
-  s->masked_tracks = 0;
-  s->audible_tracks = 0;
+      for (i = 0; i < source->allocated_tracks; i++)
+	{
+	  partial_t p;
 
-  s->threshold = sas_envelope_amplitude_threshold ();
+	  p = source->tracks + i;
+	  p->aenv[s->origin + 1] = p->aenv[previous + 1];
+	  p->fenv[s->origin + 1] = p->fenv[previous + 1];
+	}
+    }
+}
 
-  s->tracks2 =  (partial_t *) malloc (s->allocated * sizeof (partial_t));
-  assert (s->tracks2);
+void
+sas_synthesizer_set_interpolation (sas_synthesizer_t s,
+				   sas_interpolation_t mode)
+{
+  int previous;
+  int step;
 
-  s->mask = skip_list_make (compare_frequencies);
+  assert (s);
 
-  s->pool = (pool_of_masking_partials_t)
-    malloc (sizeof (struct pool_of_masking_partials_s));
-  s->pool->allocated = MAX_PARTIALS_PER_SYNTH;
-  s->pool->partials = (masking_partial_t)
-    malloc (s->pool->allocated * sizeof (struct masking_partial_s));
-  s->pool->used = 0;
+  s->interpolation = mode;
+  previous = s->origin;
 
   /* Compute the constant coefficients for the interpolation of
      amplitude and frequency during synthesis. */
@@ -1017,136 +4164,157 @@ sas_synthesizer_make (void)
       t1 = t0 * t0;
       t2 = t0 * t1;
 
-      icoeffs[step][0] = 0.5 * (      -t0 + 2.0 * t1 -       t2);
-      icoeffs[step][1] = 0.5 * ( 2.0      - 5.0 * t1 + 3.0 * t2);
-      icoeffs[step][2] = 0.5 * (       t0 + 4.0 * t1 - 3.0 * t2);
-      icoeffs[step][3] = 0.5 * (                 -t1 +       t2);
+      switch (mode)
+	{
+	case SAS_INTERPOLATION_LOW_LATENCY:
+	  {
+	    double h00, h10, h01, h11;
+
+	    /* Hermite spline between points 2 and 3, with slope (p3 -
+	       p1) / 2 at point 2 and (p3 - p2) at point 3. */
+	    h00 = 2.0 * t2 - 3.0 * t1 + 1.0;
+	    h10 =       t2 - 2.0 * t1 + t0;
+	    h01 = -2.0 * t2 + 3.0 * t1;
+	    h11 =       t2 -       t1;
+
+	    s->icoeffs[step][0] = 0.0;
+	    s->icoeffs[step][1] = -0.5 * h10;
+	    s->icoeffs[step][2] = h00 - h11;
+	    s->icoeffs[step][3] = 0.5 * h10 + h01 + h11;
+	    s->origin = 2;
+	    s->insertion_state = 1;
+	  }
+
+	  s->phase_coeffs[0] = 0.0;
+	  s->phase_coeffs[1] = -1.0 / 24.0;
+	  s->phase_coeffs[2] = 14.0 / 24.0;
+	  s->phase_coeffs[3] = 11.0 / 24.0;
+	  break;
+
+	case SAS_INTERPOLATION_SMOOTH:
+	default:
+	  /* Catmull-Rom spline between points 1 and 2. */
+	  s->icoeffs[step][0] = 0.5 * (      -t0 + 2.0 * t1 -       t2);
+	  s->icoeffs[step][1] = 0.5 * ( 2.0      - 5.0 * t1 + 3.0 * t2);
+	  s->icoeffs[step][2] = 0.5 * (       t0 + 4.0 * t1 - 3.0 * t2);
+	  s->icoeffs[step][3] = 0.5 * (                 -t1 +       t2);
+	  s->origin = 1;
+	  s->insertion_state = 2;
+
+	  s->phase_coeffs[0] = -1.0 / 24.0;
+	  s->phase_coeffs[1] = 13.0 / 24.0;
+	  s->phase_coeffs[2] = 13.0 / 24.0;
+	  s->phase_coeffs[3] = -1.0 / 24.0;
+	  break;
+	}
+    }
+
+  /* Points 'origin' and 'origin' + 1 have coefficients 1. */
+  s->amplitude_bound = 1.0;
+
+  for (step = 0; step < INTERPOLATION_STEPS; step++)
+    {
+      double sum;
+      int k;
+
+      sum = 0.0;
+      for (k = 0; k < 4; k++)
+	sum += fabs (s->icoeffs[step][k]);
+
+      s->amplitude_bound = MAX (s->amplitude_bound, sum);
     }
 
-  return s;
+  /* Partials already playing switch smoothly. */
+  if (s->origin != previous)
+    reseed_envelopes (s, previous);
 }
 
 void
-sas_synthesizer_free (sas_synthesizer_t s)
+sas_synthesizer_set_harmonic_locking (sas_synthesizer_t s, int on)
 {
   assert (s);
 
-  while (s->sources != NULL)
-    sas_synthesizer_source_delayed_free (s, s->sources);
-
-  free (s->tracks);
-  free (s->tracks2);
-  skip_list_free (s->mask);
-  free (s->pool);
-  free (s);
+#ifndef USE_RESONATOR
+  s->harmonic_locking = on;
+#endif
 }
 
-sas_source_t
-sas_synthesizer_source_make (sas_synthesizer_t s,
-			     sas_position_t pos,
-			     sas_update_callback_t update,
-			     void * call_data)
+void
+sas_synthesizer_set_harmonic_groups (sas_synthesizer_t s, int on)
 {
-  sas_source_t source;
-  int i;
-
   assert (s);
-  assert (pos);
-  assert (update);
-  assert (call_data);
-
-  source = (sas_source_t) malloc (sizeof (struct sas_source_s));
-  assert (source);
 
-  source->update = update;
-  source->call_data = call_data;
-
-  source->propagated_frames = (sas_frame_t *)
-    malloc (MAX_PROPAGATED_FRAMES * sizeof (sas_frame_t));
-  assert (source->propagated_frames);
+#ifndef USE_RESONATOR
+  s->harmonic_groups = on;
+#endif
+}
 
-  for (i = 0; i < MAX_PROPAGATED_FRAMES; i++)
-    source->propagated_frames[i] = sas_frame_make ();
+void
+sas_synthesizer_set_seed (sas_synthesizer_t s, unsigned long seed)
+{
+  assert (s);
 
-  source->emission_index = 0;
+  /* Both generators from one seed, which xorshift should not get as
+     0. */
+  seed &= SAS_RANDOM_MAX;
+  s->random_state = (seed != 0) ? seed : 1;
+  skip_list_seed (s->mask, sas_random (&s->random_state));
+}
 
-  source->position.x = pos->x;
-  source->position.y = pos->y;
-  source->position.z = pos->z;
+void
+sas_synthesizer_set_hrtf (sas_synthesizer_t s, sas_hrtf_t hrtf)
+{
+  assert (s);
 
-  source->distance =
-    DISTANCE (source->position.x,
-	      source->position.y,
-	      source->position.z);
+  s->hrtf = hrtf;
+}
 
-  source->cos_angle =
-    (source->distance > 0.0) ?
-    source->position.x / source->distance :
-    0.0;
+void
+sas_synthesizer_set_threads (sas_synthesizer_t s, int threads)
+{
+  assert (s);
 
-  source->doppler = 1.0;
+#ifdef _REENTRANT
+  if (threads - 1 == s->number_of_workers)
+    return;
 
-  update_source_spatial_information (source);
+  stop_workers (s);
+  if (threads > 1)
+    start_workers (s, threads - 1);
+#endif
+}
 
-  source->tracks = (partial_t)
-    malloc (MAX_PARTIALS_PER_SOURCE * sizeof (struct partial_s));
-  assert (source->tracks);
+void
+sas_synthesizer_set_incremental_masking (sas_synthesizer_t s, int on)
+{
+  int i;
 
-  source->active_tracks = 0;
-  source->linked_tracks = 0;
+  assert (s);
 
-  for (i = 0; i < MAX_PARTIALS_PER_SOURCE; i++)
+  if (on && !s->incremental_masking)
     {
-      partial_t p;
+      /* Masking inputs were not kept up to date. */
+      for (i = 0; i < s->active_tracks; i++)
+	if (s->tracks[i] != NULL)
+	  s->tracks[i]->mask_valid = 0;
 
-      p = source->tracks + i;
-      p->source = source;
-      p->link = NULL;
-      p->a = 0.0;
-      p->f = 440.0;
-      p->aenv[0] = p->aenv[1] = p->aenv[2] = p->aenv[3] = p->a;
-      p->fenv[0] = p->fenv[1] = p->fenv[2] = p->fenv[3] = p->f;
-      p->state = 0;
-      p->v1 = 0.0;
-      p->v2 = 0.0;
+      for (i = 0; i < MASK_BANDS; i++)
+	s->mask_dirty[i] = 1;
     }
 
-  source->next = s->sources;
-  s->sources = source;
-
-  source->delayed_free = 0;
-
-  s->number_of_sources++;
-  s->amplitude_factor =
-    1.0 / ((log (s->number_of_sources) * (1.0 / M_LN2)) + 1.0);
-
-  return source;
+  s->incremental_masking = on;
 }
 
 void
-sas_synthesizer_source_free (sas_synthesizer_t s, sas_source_t source)
+sas_synthesizer_synthesize (sas_synthesizer_t s, double * buffer)
 {
-  assert (s);
-  assert (source);
-  assert (source->delayed_free == 0);
-
-  if (source->linked_tracks == 0)
-    sas_synthesizer_source_delayed_free (s, source);
-  else
-    {
-      /* The source still has active partials in synthesizer.  Program
-         the mute of partials and the source deletion in the future. */
-      int i;
-
-      for (i = 0; i < MAX_PROPAGATED_FRAMES; i++)
-	sas_frame_set_amplitude (source->propagated_frames[i], 0.0);
-
-      source->delayed_free = 1;
-    }
+  sas_synthesizer_synthesize_reference (s, buffer, NULL);
 }
 
 void
-sas_synthesizer_synthesize (sas_synthesizer_t s, double * buffer)
+sas_synthesizer_synthesize_reference (sas_synthesizer_t s,
+				      double * buffer,
+				      double * reference)
 {
   int i;
   partial_t * src;
@@ -1154,64 +4322,246 @@ sas_synthesizer_synthesize (sas_synthesizer_t s, double * buffer)
   assert (s);
   assert (buffer);
 
+  /* Between blocks: the partials may move. */
+  grow_sources (s);
+
+#ifdef SAS_RT_GUARD
+  rt_synthesizer = s;
+#endif
+
   /* Clear buffer. */
   for (i = 0; i < 2 * SAS_SAMPLES; i++)
     buffer[i] = 0.0;
 
   update_sources (s);
   update_tracks (s);
-  update_mask (s);
+  if (s->incremental_masking)
+    update_mask_incrementally (s);
+  else
+    update_mask (s);
+#ifndef USE_RESONATOR
+  update_locking (s);
+#endif
+
+  /* Before the fast synthesis, which moves the phases on. */
+  if (reference != NULL)
+    reference_synthesis (s, reference);
 
   for (i = 0, src = s->tracks; i < s->active_tracks; i++, src++)
     {
       partial_t p;
-      int step;
       double inta[INTERPOLATION_STEPS + 1];
       double intf[INTERPOLATION_STEPS + 1];
 
+      int m;
+
       p = *src;
 
+#ifndef USE_RESONATOR
+      if (p->source->locked)
+	/* See synthesize_locked_source. */
+	continue;
+
+      if (partial_is_silent (s, p))
+	{
+	  partial_skip (s, p);
+	  continue;
+	}
+#endif
+
       /* Compute the INTERPOLATION_STEPS + 1 values for amplitude and
 	 frequency. */
-      inta[0] = p->aenv[1];
-      intf[0] = p->fenv[1];
+      partial_interpolate (s, p, inta, intf);
+
+      /* Synthesize, by coarse steps of m interpolation steps. */
+      m = INTERPOLATION_STEPS / interpolation_steps (inta, intf);
 
-      /* FIXME: does the compiler use pipelining features of the CPU?  */
-      for (step = 1; step < INTERPOLATION_STEPS; step++)
+      partial_synthesis (p, inta, intf, m, buffer);
+    }
+
+#ifndef USE_RESONATOR
+  {
+    sas_source_t source;
+
+    for (source = s->sources; source != NULL; source = source->next)
+      if (source->locked)
+	synthesize_locked_source (s, source, buffer);
+  }
+#endif
+
+  noise_synthesis (s, buffer, reference);
+
+  SAS_ATOMIC_STORE (s->blocks, s->blocks + 1);
+
+#ifdef SAS_RT_GUARD
+  rt_synthesizer = NULL;
+#endif
+}
+
+/* Outputs 'samples' samples to 'left' and 'right', synthesizing new
+   blocks when needed.  Samples are added to the channels if 'add' is
+   1, and overwrite them otherwise. */
+static inline void
+render (sas_synthesizer_t s, float * left, float * right, int samples,
+	int add)
+{
+  while (samples > 0)
+    {
+      double * block;
+      int n;
+      int i;
+
+      if (s->block_position == SAS_SAMPLES)
 	{
-	  inta[step] = interpolate_value (p->aenv, step);
-	  intf[step] = interpolate_value (p->fenv, step);
+	  sas_synthesizer_synthesize (s, s->block);
+	  s->block_position = 0;
 	}
 
-      inta[INTERPOLATION_STEPS] = p->aenv[2];
-      intf[INTERPOLATION_STEPS] = p->fenv[2];
+      n = MIN (samples, SAS_SAMPLES - s->block_position);
+      block = s->block + 2 * s->block_position;
 
-      /* Synthesize. */
-      for (step = 0; step < INTERPOLATION_STEPS; step++)
-	{
-	  double a, a_next;
-	  double f;
+      if (add)
+	for (i = 0; i < n; i++)
+	  {
+	    left[i] += (float) block[2 * i];
+	    right[i] += (float) block[2 * i + 1];
+	  }
+      else
+	for (i = 0; i < n; i++)
+	  {
+	    left[i] = (float) block[2 * i];
+	    right[i] = (float) block[2 * i + 1];
+	  }
+
+      s->block_position += n;
+      left += n;
+      right += n;
+      samples -= n;
+    }
+}
 
-	  a = inta[step];
-	  a_next = inta[step + 1];
-	  f = intf[step];
+void
+sas_synthesizer_render (sas_synthesizer_t s,
+			float * left, float * right, int samples)
+{
+  assert (s);
 
-	  if (a < MIN_AMP && a_next < MIN_AMP)
-	    /* Partial is not audible.  Don't fill buffer, but update
-	       parameters. */
-	    partial_fast_forward (p, f);
-	  else
-	    /* Partial is audible.  Fill buffer. */
-	    partial_forward_synthesis (p, a, a_next, f,
-				       buffer + step * 2 * STEP_SAMPLES);
-	}
+  render (s, left, right, samples, 0);
+}
+
+void
+sas_synthesizer_render_add (sas_synthesizer_t s,
+			    float * left, float * right, int samples)
+{
+  assert (s);
+
+  render (s, left, right, samples, 1);
+}
+
+int
+sas_synthesizer_tap (sas_synthesizer_t s, sas_partial_t ** partials)
+{
+  int n;
+  int i;
+
+  assert (s);
+  assert (partials);
+
+  /* s->tracks holds the partials synthesized in the last block, the
+     dying ones included, with the interpolation envelopes the block
+     was rendered with (see partial_interpolate). */
+  n = 0;
+
+  for (i = 0; i < s->active_tracks; i++)
+    {
+      partial_t p;
+
+      p = s->tracks[i];
+
+      if (MAX (fabs (p->aenv[s->origin]),
+	       fabs (p->aenv[s->origin + 1])) >= MIN_AMP)
+	s->tapped[n++] = p;
     }
+
+  *partials = s->tapped;
+  return n;
+}
+
+double
+sas_partial_get_frequency (sas_synthesizer_t s, sas_partial_t p)
+{
+  assert (s);
+  assert (p);
+  return interpolate_value (s, p->fenv, INTERPOLATION_STEPS / 2);
+}
+
+double
+sas_partial_get_amplitude (sas_synthesizer_t s, sas_partial_t p)
+{
+  assert (s);
+  assert (p);
+  return interpolate_value (s, p->aenv, INTERPOLATION_STEPS / 2);
+}
+
+double
+sas_partial_get_left_gain (sas_partial_t p)
+{
+  assert (p);
+  return partial_l_ratio (p);
+}
+
+double
+sas_partial_get_right_gain (sas_partial_t p)
+{
+  assert (p);
+  return partial_r_ratio (p);
+}
+
+int
+sas_partial_is_masked (sas_partial_t p)
+{
+  assert (p);
+  return p->masked;
+}
+
+sas_source_t
+sas_partial_get_source (sas_partial_t p)
+{
+  assert (p);
+  return p->source;
+}
+
+/* Memory used by a source, not counting the envelopes of its
+   frames. */
+static inline size_t
+source_footprint (sas_source_t source)
+{
+  return
+    sizeof (struct sas_source_s) +
+    source->allocated_tracks * sizeof (struct sas_partial_s) +
+    MAX_PROPAGATED_FRAMES * (sizeof (sas_frame_t) + sas_frame_size ()) +
+    ((source->noise_power != NULL) ? NOISE_BINS * sizeof (double) : 0) +
+    2 * source->raw_allocated * sizeof (double) +
+    source->queue_size * (sizeof (struct queued_frame_s) + sas_frame_size ());
+}
+
+void
+sas_synthesizer_source_reserve (sas_synthesizer_t s,
+				sas_source_t source,
+				int partials)
+{
+  assert (s);
+  assert (source);
+
+  grow_tracks (source, MIN (partials, MAX_PARTIALS_PER_SOURCE));
 }
 
 void
 sas_synthesizer_statistics (sas_synthesizer_t s,
 			    struct sas_synthesizer_statistics_s * stats)
 {
+  sas_source_t source;
+
   assert (s);
   assert (stats);
 
@@ -1219,5 +4569,34 @@ sas_synthesizer_statistics (sas_synthesizer_t s,
   stats->number_of_active_tracks = s->active_tracks;
   stats->number_of_masked_tracks = s->masked_tracks;
   stats->number_of_audible_tracks = s->audible_tracks;
+  stats->number_of_shared_scans = s->shared_scans;
+  stats->number_of_rt_allocations = s->rt_events[SAS_RT_ALLOCATION];
+  stats->number_of_rt_locks = s->rt_events[SAS_RT_LOCK];
+  stats->number_of_rt_syscalls = s->rt_events[SAS_RT_SYSCALL];
+  stats->number_of_rt_exits = s->rt_events[SAS_RT_EXIT];
+
+  stats->footprint = 0;
+  stats->number_of_dormant_sources = 0;
+  for (source = s->sources; source != NULL; source = source->next)
+    {
+      stats->footprint += source_footprint (source);
+      stats->number_of_dormant_sources += source->dormant;
+    }
+}
+
+void
+sas_synthesizer_source_statistics (sas_synthesizer_t s,
+				   sas_source_t source,
+				   struct sas_source_statistics_s * stats)
+{
+  assert (s);
+  assert (source);
+  assert (stats);
+
+  stats->number_of_partials = source->allocated_tracks;
+  stats->number_of_active_tracks = source->active_tracks;
+  stats->number_of_linked_tracks = source->linked_tracks;
+  stats->dormant = source->dormant;
+  stats->footprint = source_footprint (source);
 }
 
@@ -24,6 +24,7 @@ extern "C" {
 #endif
 
 #include "sas_frame.h"
+#include "sas_hrtf.h"
 
 /* The sampling rate at which the temporal signal is output from a SAS
    synthesizer. */
@@ -37,7 +38,11 @@ extern "C" {
    right). */
 #define SAS_SAMPLES 512
 
-/* Abstract data type for SAS synthesizers. */
+/* Abstract data type for SAS synthesizers.  Synthesizers don't share
+   any mutable state: when libsas is compiled with _REENTRANT,
+   different synthesizers can be used concurrently from different
+   threads.  A given synthesizer, and the frames given to it, should
+   be used by one thread at a time. */
 typedef struct sas_synthesizer_s * sas_synthesizer_t;
 
 /* Abstract data type for sources (or voices) in SAS synthesizers.  A
@@ -51,6 +56,10 @@ typedef struct sas_synthesizer_s * sas_synthesizer_t;
    coming from the source is synthesized. */
 typedef struct sas_source_s * sas_source_t;
 
+/* Abstract data type for the partials heard in the last block of a
+   synthesizer (see sas_synthesizer_tap). */
+typedef struct sas_partial_s * sas_partial_t;
+
 /* Concrete data types for 3D positions of sources with regard to the
    listener.  Unit is meter. */
 typedef struct sas_position_s * sas_position_t;
@@ -81,6 +90,20 @@ typedef void (* sas_update_callback_t) (sas_synthesizer_t s,
 					sas_position_t * pos,
 					void * call_data);
 
+/* Interpolation modes of the amplitudes and frequencies of partials
+   between consecutive frames (see
+   sas_synthesizer_set_interpolation). */
+typedef enum {
+  /* Catmull-Rom spline through the last four frames.  Smooth, but a
+     new frame is heard about two blocks of SAS_SAMPLES samples after
+     the update.  This is the default. */
+  SAS_INTERPOLATION_SMOOTH,
+  /* Hermite spline toward the newest frame, with a slope predicted
+     from the previous frames.  A new frame is reached within the
+     block that follows the update, which suits live control. */
+  SAS_INTERPOLATION_LOW_LATENCY
+} sas_interpolation_t;
+
 /* Allocates a new SAS synthesizer with no source. */
 extern sas_synthesizer_t sas_synthesizer_make (void);
 
@@ -90,23 +113,254 @@ extern void sas_synthesizer_free (sas_synthesizer_t s);
 
 /* Allocates a new source in a synthesizer.  The position argument
    corresponds to the initial position of the source with regard to
-   the listener.  The source is initially silent. */
+   the listener.  The source is initially silent.  A silent source
+   sleeps: once its partials have died out and its last sound has
+   reached the listener, it costs nothing but the call to its update
+   callback, until it is given a frame with a non-zero amplitude (or
+   partials, see sas_synthesizer_source_set_partials).  Large pools
+   of idle sources are thus cheap.  If 'update' is
+   NULL, the source is updated with sas_synthesizer_bulk_update
+   instead of a callback, and 'call_data' is not used. */
 extern sas_source_t sas_synthesizer_source_make (sas_synthesizer_t s,
 						 sas_position_t pos,
 						 sas_update_callback_t update,
 						 void * call_data);
 
 /* Deletes a source from a SAS synthesizer.  The source can't be used
-   anymore. */
+   anymore, and its update callback is not called anymore: the
+   partials still playing fade out. */
 extern void sas_synthesizer_source_free (sas_synthesizer_t s,
 					 sas_source_t source);
 
+/* Updates 'n' sources at once, for the next block.  The sources must
+   have been made without an update callback.  The frame of
+   'sources[i]' gets amplitude 'amplitudes[i]', fundamental frequency
+   'frequencies[i]', color 'colors[i]', warp 'warps[i]' and noise
+   'noises[i]', and the source moves to 'positions[i]'.  'colors',
+   'warps', 'noises' or 'positions' may be NULL, to keep the previous
+   colors, warps, noises or positions of the sources.  The envelopes are kept by the synthesizer (see
+   sas_envelope_keep), and the arrays can be reused as soon as the
+   call returns.  A source that is not given before the next call to
+   sas_synthesizer_synthesize (or render) is frozen, as if its update
+   callback had returned no frame.  Call from the thread that
+   synthesizes. */
+extern void sas_synthesizer_bulk_update (sas_synthesizer_t s,
+					 int n,
+					 sas_source_t * sources,
+					 double * amplitudes,
+					 double * frequencies,
+					 sas_envelope_t * colors,
+					 sas_envelope_t * warps,
+					 sas_envelope_t * noises,
+					 struct sas_position_s * positions);
+
+/* Updates a source made without an update callback with an explicit
+   list of 'n' partials for the next block, instead of a frame (see
+   sas_synthesizer_bulk_update): partial 'i' has frequency
+   'frequencies[i]', in Hz, and amplitude 'amplitudes[i]'.  The
+   partial of index 'i' in successive lists is one and the same
+   partial, interpolated from one block to the next: it is born when
+   it gets audible and dies when it gets inaudible or is not listed
+   anymore.  Color and warp envelopes are not involved, but the
+   partials still go through the audibility threshold, the distance
+   attenuation, the Doppler shift and masking.  Unlike frames, the
+   partials are heard without propagation delay.  The source moves to
+   'pos', unless it is NULL.  The arrays are copied, and can be reused
+   as soon as the call returns.  A source not given before the next
+   block is frozen, and a source given to sas_synthesizer_bulk_update
+   goes back to frames.  Call from the thread that synthesizes. */
+extern void sas_synthesizer_source_set_partials (sas_synthesizer_t s,
+						 sas_source_t source,
+						 int n,
+						 double * frequencies,
+						 double * amplitudes,
+						 sas_position_t pos);
+
+/* Gives a source made without an update callback a queue of 'size'
+   timestamped frames, that a thread of the client (a loader or a
+   sequencer) fills ahead with sas_synthesizer_source_push, while the
+   synthesizer takes them as their time comes.  Frames that are
+   expensive to make (decoded from files, morphed, etc.) can then be
+   made outside of the thread that synthesizes.  At each block, the
+   last frame due (see sas_synthesizer_get_time) is taken, as if given
+   by sas_synthesizer_bulk_update, the earlier ones being skipped; the
+   source is frozen if no frame is due.  Call once, from the thread
+   that synthesizes. */
+extern void sas_synthesizer_source_queue (sas_synthesizer_t s,
+					  sas_source_t source,
+					  int size);
+
+/* Pushes a copy of 'frame' and 'pos' into the queue of a source (see
+   above), due at 'time' seconds on the clock of the synthesizer.
+   'pos' may be NULL to keep the position.  Times should not
+   decrease.  Returns 1, or 0 if the queue is full.  Without locks:
+   one thread at a time may push frames into a given queue, while
+   another one synthesizes. */
+extern int sas_synthesizer_source_push (sas_synthesizer_t s,
+					sas_source_t source,
+					double time,
+					sas_frame_t frame,
+					sas_position_t pos);
+
+/* Returns the time, in seconds, of the next block to be synthesized,
+   that is SAS_SAMPLES / SAS_SAMPLING_RATE times the number of blocks
+   synthesized so far.  A frame pushed with this time is taken by the
+   next block.  Can be called from any thread. */
+extern double sas_synthesizer_get_time (sas_synthesizer_t s);
+
+/* Restarts the pseudo-random numbers of a synthesizer (initial phases
+   of partials, phases of noise) from 'seed'.  Synthesizers given the
+   same seed, settings and input output the same samples, which
+   allows bit-exact comparisons of builds.  A synthesizer is otherwise
+   seeded from the time of its creation. */
+extern void sas_synthesizer_set_seed (sas_synthesizer_t s,
+				      unsigned long seed);
+
+/* Sets the interpolation mode of a synthesizer.  The mode can be
+   changed at any time, partials already playing switch smoothly: the
+   next block starts from the values the last one ended with.
+   Switching to low latency skips the frame that was not reached yet,
+   and switching back holds the last values for one more block. */
+extern void sas_synthesizer_set_interpolation (sas_synthesizer_t s,
+					       sas_interpolation_t mode);
+
+/* Turns harmonic locking on (on = 1) or off (on = 0, the default).
+   With harmonic locking, the partials of a source whose heard frame
+   has the identity warp (see sas_envelope_warp_identity) are
+   synthesized from one phasor at the fundamental frequency, which is
+   much faster for sources with many harmonics.  The phases of the
+   harmonics are then locked to the one of the fundamental, instead of
+   being random. */
+extern void sas_synthesizer_set_harmonic_locking (sas_synthesizer_t s,
+						  int on);
+
+/* Turns harmonic groups on (on = 1) or off (on = 0, the default).
+   With harmonic groups, runs of locked harmonics (see above) whose
+   amplitudes are equal or decay geometrically, within 1%, are
+   synthesized in closed form, at a cost that does not depend on
+   their number. */
+extern void sas_synthesizer_set_harmonic_groups (sas_synthesizer_t s,
+						 int on);
+
+/* Turns the binaural mode on, with an HRTF set (see sas_hrtf.h), or
+   off (hrtf = NULL, the default), for panning.  In binaural mode,
+   each partial gets the magnitudes of the HRTF set at its frequency,
+   interpolated in the direction of its source, and the interaural
+   time difference as a phase offset between the left and right
+   channels.  Harmonic locking is not used in binaural mode, and the
+   noise of the frames keeps the panning.  The set is not copied: it
+   should not be freed while the synthesizer uses it.  Call from the
+   thread that synthesizes. */
+extern void sas_synthesizer_set_hrtf (sas_synthesizer_t s, sas_hrtf_t hrtf);
+
+/* Allocates at least 'partials' partials for a source.  This is the
+   way to avoid memory allocation in the thread that synthesizes, for
+   sources with a known maximal number of harmonics.  Otherwise, a
+   source starts with a few partials: when it has more audible
+   harmonics, the ones that don't fit are left out of the block, and
+   the source grows at the start of the next call to
+   sas_synthesizer_synthesize (or render), in that thread.  Call from
+   the thread that synthesizes. */
+extern void sas_synthesizer_source_reserve (sas_synthesizer_t s,
+					    sas_source_t source,
+					    int partials);
+
+/* Sets the number of threads that update the sources at the start of
+   each block (1, the default, for the calling thread only).  With
+   several threads, the update callbacks of different sources may be
+   called concurrently, from the calling thread and from worker
+   threads of the synthesizer.  The tracks are then linked into the
+   synthesizer by the calling thread, in the order of the sources, so
+   that the output does not depend on the number of threads.  Only
+   available if libsas is compiled with _REENTRANT. */
+extern void sas_synthesizer_set_threads (sas_synthesizer_t s, int threads);
+
+/* Turns incremental masking on (on = 1) or off (on = 0, the default).
+   With incremental masking, the masking of partials is only
+   recomputed in the parts of the spectrum where partials appeared,
+   disappeared, or moved by more than 1% in frequency or 1 dB in
+   amplitude since the last block.  Elsewhere, the previous verdicts
+   are kept. */
+extern void sas_synthesizer_set_incremental_masking (sas_synthesizer_t s,
+						     int on);
+
 /* Calls each source's update callback, and fills 'buffer' with 2 *
    SAS_SAMPLES samples computed by the forward synthesis of the
    sources in the synthesizer.  The left and right channels are
-   interleaved in 'buffer'. */
+   interleaved in 'buffer'.  The noise of the frames (see
+   sas_frame_set_noise) is synthesized by overlapped inverse FFTs of
+   SAS_SAMPLES points, every SAS_SAMPLES / 2 samples, whatever the
+   number of noisy sources. */
 extern void sas_synthesizer_synthesize (sas_synthesizer_t s, double * buffer);
 
+/* Same as sas_synthesizer_synthesize, and also fills 'reference' (if
+   not NULL) with 2 * SAS_SAMPLES samples of a slow reference
+   synthesis of the same partials: each one is computed sample by
+   sample with sin, with exact phases and without the faster paths
+   (harmonic locking and groups, coarse steps, skipped silent
+   partials).  The masking verdicts are the ones of the block.
+   Comparing both buffers (see sas_accuracy.h) checks the accuracy of
+   the fast synthesis.  The noise of the frames is added to both
+   buffers alike.  Reference phases are kept from one block to
+   the next, so that the drift of the fast phases shows: call this
+   function for every block of the run being checked. */
+extern void sas_synthesizer_synthesize_reference (sas_synthesizer_t s,
+						  double * buffer,
+						  double * reference);
+
+/* Writes the next 'samples' samples of the left and right channels
+   into 'left' and 'right', for any number of samples.  Blocks of
+   SAS_SAMPLES samples are synthesized as needed (see
+   sas_synthesizer_synthesize), and the samples not yet output are
+   kept for the next call.  Do not mix with calls to
+   sas_synthesizer_synthesize on the same synthesizer. */
+extern void sas_synthesizer_render (sas_synthesizer_t s,
+				    float * left, float * right, int samples);
+
+/* Same as sas_synthesizer_render, but adds the samples to the
+   contents of 'left' and 'right'. */
+extern void sas_synthesizer_render_add (sas_synthesizer_t s,
+					float * left, float * right,
+					int samples);
+
+/* Sets '*partials' to the partials heard in the last block
+   synthesized, and returns their number.  These are all the partials
+   rendered in the block, the ones fading out included (after their
+   death or their masking, see sas_partial_is_masked), without the
+   noise of the frames, in no particular order.  The array belongs to
+   the synthesizer, and is filled again at each call: it may be
+   reordered, and is valid until the next block is synthesized or
+   partials are reserved (see sas_synthesizer_source_reserve).
+   Spectral displays and descriptors can thus follow the synthesis at
+   little cost.  Call from the thread that synthesizes. */
+extern int sas_synthesizer_tap (sas_synthesizer_t s,
+				sas_partial_t ** partials);
+
+/* Return the frequency of a partial heard in the last block (see
+   sas_synthesizer_tap), in Hz, with the Doppler shift, and its
+   amplitude, with the distance attenuation, as rendered in the
+   middle of the block.  The interpolation of the partial may already
+   be heading for other values (see
+   sas_synthesizer_set_interpolation). */
+extern double sas_partial_get_frequency (sas_synthesizer_t s,
+					 sas_partial_t p);
+extern double sas_partial_get_amplitude (sas_synthesizer_t s,
+					 sas_partial_t p);
+
+/* Return the gains of a partial on the left and right channels, that
+   is the panning of its source or, in binaural mode, the magnitudes
+   of the HRTF set. */
+extern double sas_partial_get_left_gain (sas_partial_t p);
+extern double sas_partial_get_right_gain (sas_partial_t p);
+
+/* Returns 1 if a partial was masked in the last block, 0 otherwise.
+   A masked partial fades out over the next blocks, and is not
+   synthesized once silent. */
+extern int sas_partial_is_masked (sas_partial_t p);
+
+/* Returns the source a partial belongs to. */
+extern sas_source_t sas_partial_get_source (sas_partial_t p);
+
 #ifdef __cplusplus
 }
 #endif
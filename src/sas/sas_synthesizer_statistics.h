@@ -29,6 +29,43 @@ struct sas_synthesizer_statistics_s
   int number_of_active_tracks;
   int number_of_masked_tracks;
   int number_of_audible_tracks;
+  /* Number of sources whose harmonics were taken from the scan of
+     another source in the last block, because they heard frames with
+     the same color, warp and frequency (the amplitudes may differ). */
+  int number_of_shared_scans;
+  /* Number of memory allocations, locks, blocking system calls and
+     fatal exits reached during synthesis since the synthesizer was
+     made, including from the update callbacks.  Only counted when
+     libsas is compiled with SAS_RT_GUARD, for debugging: a
+     synthesizer fit for live use keeps them at 0 once warmed up. */
+  int number_of_rt_allocations;
+  int number_of_rt_locks;
+  int number_of_rt_syscalls;
+  int number_of_rt_exits;
+  /* Number of sources asleep, because they are silent (see
+     sas_synthesizer_source_make). */
+  int number_of_dormant_sources;
+  /* Memory used by the sources, in bytes (see below). */
+  size_t footprint;
+};
+
+/* Concrete data type of structures containing instantaneous
+   information about a source in a SAS synthesizer. */
+struct sas_source_statistics_s
+{
+  /* Partials allocated for the source.  They grow with the number of
+     audible harmonics of the source (see
+     sas_synthesizer_source_reserve). */
+  int number_of_partials;
+  int number_of_active_tracks;
+  int number_of_linked_tracks;
+  /* 1 if the source is asleep. */
+  int dormant;
+  /* Memory used by the source, in bytes: its partials, its
+     propagated frames, its noise spectrum and its explicit partials
+     (see sas_synthesizer_source_set_partials), not counting the
+     envelopes of the frames. */
+  size_t footprint;
 };
 
 /* Fills 'stats' with current information about 's'. */
@@ -36,4 +73,10 @@ extern void
 sas_synthesizer_statistics (sas_synthesizer_t s,
 			    struct sas_synthesizer_statistics_s * stats);
 
+/* Fills 'stats' with current information about 'source' in 's'. */
+extern void
+sas_synthesizer_source_statistics (sas_synthesizer_t s,
+				   sas_source_t source,
+				   struct sas_source_statistics_s * stats);
+
 #endif
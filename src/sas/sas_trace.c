@@ -0,0 +1,789 @@
+/* libsas - library for Structured Additive Synthesis
+   Copyright (C) 1999-2001 Sylvain Marchand
+   Copyright (C) 2001-2002 SCRIME, universit Bordeaux 1
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#ifdef _REENTRANT
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+#include "fileio.h"
+#include "ieeefloat.h"
+#include "sas_common.h"
+#include "sas_envelope.h"
+#include "sas_frame.h"
+#include "sas_synthesizer.h"
+#include "sas_trace.h"
+
+#include "sas_envelope_private.c"
+
+/* Trace file format.  All numbers are big-endian: LONGs on 4 bytes,
+   doubles in IEEE double format on 8 bytes.  The file starts with the
+   'SAST' identifier and the version of the format, followed by
+   records made of an identifier and data:
+
+     'MAKE' source x y z               A source is made.
+     'FREE' source                     A source is deleted.
+     'ENVL' slot kind [base size data] An envelope enters a slot.
+     'FRAM' source A F color warp noise x y z
+                                       Frame and position of a source
+                                       for the current block, the
+                                       envelopes being given by slot.
+     'PART' source n x y z (f a)*n     Explicit partials and position
+                                       of a source for the current
+                                       block (see
+                                       sas_synthesizer_source_set_partials).
+     'BLCK'                            End of a block.
+
+   The kind of an envelope is a byte: TRACE_COLOR_0 and
+   TRACE_WARP_IDENTITY stand for the standard envelopes, and
+   TRACE_DATA is followed by the base and size of the envelope, and
+   its size + 4 control values (including the two values kept on both
+   sides for interpolation). */
+
+#define MAX(x,y) (((y)>(x))?(y):(x))
+
+#define TRACE_VERSION 3
+
+#define TRACE_DATA 0
+#define TRACE_COLOR_0 1
+#define TRACE_WARP_IDENTITY 2
+
+/* Envelopes are written once, into one of TRACE_SLOTS slots chosen
+   by address, and referred to by slot afterwards.  The trace keeps
+   the envelope of each slot, so that its address is not reused by
+   another envelope while it is in the slot.  Colors, warps and noises
+   each take a third of the slots, so that the envelopes of a frame
+   never compete for the same slot. */
+#define TRACE_SLOTS 384
+#define TRACE_SLOT(e) ((((unsigned long) (e) >> 5) ^ \
+			((unsigned long) (e) >> 13)) % (TRACE_SLOTS / 3))
+
+/* Recording (with _REENTRANT): records go into a ring of
+   TRACE_RING_SIZE bytes (a power of 2), and a writer thread of the
+   trace writes them to the file every TRACE_WRITER_SLEEP
+   microseconds.  A block of a hundred sources takes a few
+   kilobytes. */
+#define TRACE_RING_SIZE (1 << 20)
+#define TRACE_WRITER_SLEEP 5000
+
+struct sas_trace_s {
+  FILE * fp;
+  /* 1 if the trace was created for recording, 0 if opened for
+     replay. */
+  int recording;
+  /* 1 if writing failed once. */
+  int error;
+  sas_envelope_t envelopes[TRACE_SLOTS];
+#ifdef _REENTRANT
+  /* Recording: the ring of records, the free running index of the
+     next byte written by the synthesizer ('head') and of the next one
+     written to the file by the writer thread ('tail'), each index
+     being only written by its own side. */
+  char * ring;
+  unsigned int head;
+  unsigned int tail;
+  int quit;
+  pthread_t writer;
+#endif
+  /* Replay: the sources made so far, by number. */
+  sas_source_t * sources;
+  int number_of_sources;
+  /* Replay: the frames of the current block, for
+     sas_synthesizer_bulk_update. */
+  int block_size;
+  int allocated;
+  sas_source_t * block_sources;
+  double * amplitudes;
+  double * frequencies;
+  sas_envelope_t * colors;
+  sas_envelope_t * warps;
+  sas_envelope_t * noises;
+  struct sas_position_s * positions;
+};
+
+static sas_trace_t
+trace_make (FILE * fp, int recording)
+{
+  sas_trace_t t;
+  int i;
+
+  t = (sas_trace_t) malloc (sizeof (struct sas_trace_s));
+  assert (t);
+
+  t->fp = fp;
+  t->recording = recording;
+  t->error = 0;
+
+  for (i = 0; i < TRACE_SLOTS; i++)
+    t->envelopes[i] = NULL;
+
+  t->sources = NULL;
+  t->number_of_sources = 0;
+
+  t->block_size = 0;
+  t->allocated = 0;
+  t->block_sources = NULL;
+  t->amplitudes = NULL;
+  t->frequencies = NULL;
+  t->colors = NULL;
+  t->warps = NULL;
+  t->noises = NULL;
+  t->positions = NULL;
+
+#ifdef _REENTRANT
+  t->ring = NULL;
+  t->head = 0;
+  t->tail = 0;
+  t->quit = 0;
+#endif
+
+  return t;
+}
+
+#ifdef _REENTRANT
+
+/* Writes the bytes of the ring up to 'head' to the file. */
+static void
+drain_ring (sas_trace_t t, unsigned int head)
+{
+  while (t->tail != head)
+    {
+      unsigned int start;
+      unsigned int n;
+
+      start = t->tail % TRACE_RING_SIZE;
+      n = head - t->tail;
+      if (n > TRACE_RING_SIZE - start)
+	n = TRACE_RING_SIZE - start;
+
+      if (fwrite (t->ring + start, 1, n, t->fp) != n)
+	t->error = 1;
+
+      SAS_ATOMIC_STORE (t->tail, t->tail + n);
+    }
+}
+
+static void *
+writer_main (void * data)
+{
+  sas_trace_t t;
+
+  t = (sas_trace_t) data;
+
+  for (;;)
+    {
+      int quit;
+
+      /* Read 'quit' first, so that the records written before it was
+	 set are all drained. */
+      quit = SAS_ATOMIC_LOAD (t->quit);
+      drain_ring (t, SAS_ATOMIC_LOAD (t->head));
+      if (quit)
+	break;
+      usleep (TRACE_WRITER_SLEEP);
+    }
+
+  return NULL;
+}
+
+#endif
+
+sas_trace_t
+sas_trace_create (const char * filename)
+{
+  sas_trace_t t;
+  FILE * fp;
+
+  assert (filename);
+
+  fp = fopen (filename, "wb");
+  if (!fp)
+    {
+      REPORT (perror ("sas_trace_create: fopen failed"));
+      return NULL;
+    }
+
+  if ((!IO_Write_BE_ULONG (MakeID ('S', 'A', 'S', 'T'), fp)) ||
+      (!IO_Write_BE_LONG (TRACE_VERSION, fp)))
+    {
+      fclose (fp);
+      return NULL;
+    }
+
+  t = trace_make (fp, 1);
+
+#ifdef _REENTRANT
+  t->ring = (char *) malloc (TRACE_RING_SIZE);
+  assert (t->ring);
+
+  if (pthread_create (&t->writer, NULL, writer_main, t) != 0)
+    {
+      fprintf (stderr, "sas_trace_create: fatal: cannot create thread.\n");
+      exit (EXIT_FAILURE);
+    }
+#endif
+
+  return t;
+}
+
+sas_trace_t
+sas_trace_open (const char * filename)
+{
+  FILE * fp;
+  ULONG id;
+  LONG version;
+
+  assert (filename);
+
+  fp = fopen (filename, "rb");
+  if (!fp)
+    {
+      REPORT (perror ("sas_trace_open: fopen failed"));
+      return NULL;
+    }
+
+  if ((!IO_Read_BE_ULONG (&id, fp)) ||
+      (id != MakeID ('S', 'A', 'S', 'T')) ||
+      (!IO_Read_BE_LONG (&version, fp)) ||
+      (version != TRACE_VERSION))
+    {
+      fclose (fp);
+      return NULL;
+    }
+
+  return trace_make (fp, 0);
+}
+
+void
+sas_trace_close (sas_trace_t t)
+{
+  int i;
+
+  assert (t);
+
+#ifdef _REENTRANT
+  if (t->recording)
+    {
+      SAS_ATOMIC_STORE (t->quit, 1);
+      pthread_join (t->writer, NULL);
+      free (t->ring);
+    }
+#endif
+
+  if (t->error)
+    REPORT (fprintf (stderr, "sas_trace_close: trace incomplete.\n"));
+
+  fclose (t->fp);
+
+  for (i = 0; i < TRACE_SLOTS; i++)
+    if (t->envelopes[i] != NULL)
+      sas_envelope_free (t->envelopes[i]);
+
+  free (t->sources);
+  free (t->block_sources);
+  free (t->amplitudes);
+  free (t->frequencies);
+  free (t->colors);
+  free (t->warps);
+  free (t->noises);
+  free (t->positions);
+  free (t);
+}
+
+/* Recording. */
+
+/* Records are written during synthesis.  With _REENTRANT, they go
+   into the ring, for the writer thread.  If the file cannot keep up
+   and the ring is full, the synthesis waits for the writer.  Without
+   _REENTRANT, they are written to the file, through the buffers of
+   the C library: recording is then not real-time safe. */
+static inline void
+write_bytes (sas_trace_t t, const char * data, unsigned int n)
+{
+#ifdef _REENTRANT
+  unsigned int i;
+
+  while (t->head + n - SAS_ATOMIC_LOAD (t->tail) > TRACE_RING_SIZE)
+    {
+      SAS_RT_EVENT (SAS_RT_SYSCALL);
+      sched_yield ();
+    }
+
+  for (i = 0; i < n; i++)
+    t->ring[(t->head + i) % TRACE_RING_SIZE] = data[i];
+
+  SAS_ATOMIC_STORE (t->head, t->head + n);
+#else
+  SAS_RT_EVENT (SAS_RT_SYSCALL);
+  if (fwrite (data, 1, n, t->fp) != n)
+    t->error = 1;
+#endif
+}
+
+static inline void
+write_ubyte (sas_trace_t t, UBYTE value)
+{
+  char data[1];
+
+  data[0] = value;
+  write_bytes (t, data, 1);
+}
+
+static inline void
+write_long (sas_trace_t t, LONG value)
+{
+  char data[4];
+
+  /* Big-endian, as IO_Write_BE_LONG. */
+  data[0] = (value >> 24) & 0xff;
+  data[1] = (value >> 16) & 0xff;
+  data[2] = (value >> 8) & 0xff;
+  data[3] = value & 0xff;
+  write_bytes (t, data, 4);
+}
+
+static inline void
+write_id (sas_trace_t t, ULONG id)
+{
+  write_long (t, (LONG) id);
+}
+
+static inline void
+write_double (sas_trace_t t, double value)
+{
+  char data[kDoubleLength];
+
+  ConvertToIeeeDouble (value, data);
+  write_bytes (t, data, kDoubleLength);
+}
+
+static inline void
+write_position (sas_trace_t t, sas_position_t pos)
+{
+  write_double (t, pos->x);
+  write_double (t, pos->y);
+  write_double (t, pos->z);
+}
+
+/* Returns the slot of an envelope, writing the envelope first if it
+   is not in its slot yet.  'first' is the first slot of the third for
+   the kind of envelope. */
+static inline int
+write_envelope (sas_trace_t t, sas_envelope_t e, int first)
+{
+  int slot;
+  int i;
+
+  slot = first + TRACE_SLOT (e);
+
+  if (t->envelopes[slot] == e)
+    return slot;
+
+  if (t->envelopes[slot] != NULL)
+    sas_envelope_free (t->envelopes[slot]);
+  sas_envelope_keep (e);
+  t->envelopes[slot] = e;
+
+  write_id (t, MakeID ('E', 'N', 'V', 'L'));
+  write_long (t, slot);
+
+  if (e == sas_envelope_color_0 ())
+    write_ubyte (t, TRACE_COLOR_0);
+  else if (e == sas_envelope_warp_identity ())
+    write_ubyte (t, TRACE_WARP_IDENTITY);
+  else
+    {
+      write_ubyte (t, TRACE_DATA);
+      write_double (t, e->base);
+      write_long (t, e->size);
+      for (i = -2; i < e->size + 2; i++)
+	write_double (t, e->data[i]);
+    }
+
+  return slot;
+}
+
+void
+sas_trace_write_make (sas_trace_t t, int source, sas_position_t pos)
+{
+  assert (t && t->recording);
+
+  write_id (t, MakeID ('M', 'A', 'K', 'E'));
+  write_long (t, source);
+  write_position (t, pos);
+}
+
+void
+sas_trace_write_free (sas_trace_t t, int source)
+{
+  assert (t && t->recording);
+
+  write_id (t, MakeID ('F', 'R', 'E', 'E'));
+  write_long (t, source);
+}
+
+void
+sas_trace_write_frame (sas_trace_t t, int source,
+		       sas_frame_t frame, sas_position_t pos)
+{
+  int color;
+  int warp;
+  int noise;
+
+  assert (t && t->recording);
+
+  /* Envelope records go before the frame record. */
+  color = write_envelope (t, sas_frame_get_color (frame), 0);
+  warp = write_envelope (t, sas_frame_get_warp (frame), TRACE_SLOTS / 3);
+  noise = write_envelope (t, sas_frame_get_noise (frame),
+			  2 * TRACE_SLOTS / 3);
+
+  write_id (t, MakeID ('F', 'R', 'A', 'M'));
+  write_long (t, source);
+  write_double (t, sas_frame_get_amplitude (frame));
+  write_double (t, sas_frame_get_frequency (frame));
+  write_long (t, color);
+  write_long (t, warp);
+  write_long (t, noise);
+  write_position (t, pos);
+}
+
+void
+sas_trace_write_partials (sas_trace_t t, int source, int n,
+			  double * frequencies, double * amplitudes,
+			  sas_position_t pos)
+{
+  int i;
+
+  assert (t && t->recording);
+
+  write_id (t, MakeID ('P', 'A', 'R', 'T'));
+  write_long (t, source);
+  write_long (t, n);
+  write_position (t, pos);
+  for (i = 0; i < n; i++)
+    {
+      write_double (t, frequencies[i]);
+      write_double (t, amplitudes[i]);
+    }
+}
+
+void
+sas_trace_write_block (sas_trace_t t)
+{
+  assert (t && t->recording);
+
+  write_id (t, MakeID ('B', 'L', 'C', 'K'));
+}
+
+/* Replay. */
+
+static inline int
+read_double (sas_trace_t t, double * value)
+{
+  char data[kDoubleLength];
+
+  if (!IO_Read_Str (data, kDoubleLength, t->fp))
+    return 0;
+
+  *value = ConvertFromIeeeDouble (data);
+  return 1;
+}
+
+static inline int
+read_position (sas_trace_t t, sas_position_t pos)
+{
+  return
+    read_double (t, &pos->x) &&
+    read_double (t, &pos->y) &&
+    read_double (t, &pos->z);
+}
+
+static int
+read_envelope (sas_trace_t t)
+{
+  LONG slot;
+  UBYTE kind;
+  sas_envelope_t e;
+
+  if ((!IO_Read_BE_LONG (&slot, t->fp)) ||
+      (slot < 0) || (slot >= TRACE_SLOTS) ||
+      (!IO_Read_UBYTE (&kind, t->fp)))
+    return 0;
+
+  switch (kind)
+    {
+    case TRACE_COLOR_0:
+      e = sas_envelope_color_0 ();
+      break;
+    case TRACE_WARP_IDENTITY:
+      e = sas_envelope_warp_identity ();
+      break;
+    case TRACE_DATA:
+      {
+	double base;
+	LONG size;
+	double * values;
+	int i;
+
+	if ((!read_double (t, &base)) ||
+	    (!IO_Read_BE_LONG (&size, t->fp)) ||
+	    (size <= 0))
+	  return 0;
+
+	values = (double *) malloc ((size + 4) * sizeof (double));
+	assert (values);
+
+	for (i = 0; i < size + 4; i++)
+	  if (!read_double (t, values + i))
+	    {
+	      free (values);
+	      return 0;
+	    }
+
+	e = sas_envelope_make (base, size, values + 2);
+	e->data[-2] = values[0];
+	e->data[-1] = values[1];
+	e->data[size] = values[size + 2];
+	e->data[size + 1] = values[size + 3];
+	free (values);
+      }
+      break;
+    default:
+      return 0;
+    }
+
+  sas_envelope_keep (e);
+  if (t->envelopes[slot] != NULL)
+    sas_envelope_free (t->envelopes[slot]);
+  t->envelopes[slot] = e;
+
+  return 1;
+}
+
+static int
+read_make (sas_trace_t t, sas_synthesizer_t s)
+{
+  LONG source;
+  struct sas_position_s pos;
+
+  if ((!IO_Read_BE_LONG (&source, t->fp)) ||
+      (source < 0) ||
+      (!read_position (t, &pos)))
+    return 0;
+
+  if (source >= t->number_of_sources)
+    {
+      int n;
+
+      n = MAX (source + 1, 2 * t->number_of_sources);
+      t->sources = (sas_source_t *)
+	realloc (t->sources, n * sizeof (sas_source_t));
+      assert (t->sources);
+      for (; t->number_of_sources < n; t->number_of_sources++)
+	t->sources[t->number_of_sources] = NULL;
+    }
+
+  if (t->sources[source] != NULL)
+    return 0;
+
+  t->sources[source] = sas_synthesizer_source_make (s, &pos, NULL, NULL);
+
+  return 1;
+}
+
+static int
+read_free (sas_trace_t t, sas_synthesizer_t s)
+{
+  LONG source;
+
+  if ((!IO_Read_BE_LONG (&source, t->fp)) ||
+      (source < 0) || (source >= t->number_of_sources) ||
+      (t->sources[source] == NULL))
+    return 0;
+
+  sas_synthesizer_source_free (s, t->sources[source]);
+  t->sources[source] = NULL;
+
+  return 1;
+}
+
+static int
+read_frame (sas_trace_t t)
+{
+  LONG source;
+  LONG color;
+  LONG warp;
+  LONG noise;
+  int i;
+
+  if (t->block_size == t->allocated)
+    {
+      t->allocated = MAX (16, 2 * t->allocated);
+      t->block_sources = (sas_source_t *)
+	realloc (t->block_sources, t->allocated * sizeof (sas_source_t));
+      t->amplitudes = (double *)
+	realloc (t->amplitudes, t->allocated * sizeof (double));
+      t->frequencies = (double *)
+	realloc (t->frequencies, t->allocated * sizeof (double));
+      t->colors = (sas_envelope_t *)
+	realloc (t->colors, t->allocated * sizeof (sas_envelope_t));
+      t->warps = (sas_envelope_t *)
+	realloc (t->warps, t->allocated * sizeof (sas_envelope_t));
+      t->noises = (sas_envelope_t *)
+	realloc (t->noises, t->allocated * sizeof (sas_envelope_t));
+      t->positions = (struct sas_position_s *)
+	realloc (t->positions,
+		 t->allocated * sizeof (struct sas_position_s));
+      assert (t->block_sources && t->amplitudes && t->frequencies &&
+	      t->colors && t->warps && t->noises && t->positions);
+    }
+
+  i = t->block_size;
+
+  if ((!IO_Read_BE_LONG (&source, t->fp)) ||
+      (source < 0) || (source >= t->number_of_sources) ||
+      (t->sources[source] == NULL) ||
+      (!read_double (t, t->amplitudes + i)) ||
+      (!read_double (t, t->frequencies + i)) ||
+      (!IO_Read_BE_LONG (&color, t->fp)) ||
+      (color < 0) || (color >= TRACE_SLOTS) ||
+      (t->envelopes[color] == NULL) ||
+      (!IO_Read_BE_LONG (&warp, t->fp)) ||
+      (warp < 0) || (warp >= TRACE_SLOTS) ||
+      (t->envelopes[warp] == NULL) ||
+      (!IO_Read_BE_LONG (&noise, t->fp)) ||
+      (noise < 0) || (noise >= TRACE_SLOTS) ||
+      (t->envelopes[noise] == NULL) ||
+      (!read_position (t, t->positions + i)))
+    return 0;
+
+  /* Kept until the end of the block, in case another envelope takes
+     their slot. */
+  t->block_sources[i] = t->sources[source];
+  t->colors[i] = t->envelopes[color];
+  sas_envelope_keep (t->colors[i]);
+  t->warps[i] = t->envelopes[warp];
+  sas_envelope_keep (t->warps[i]);
+  t->noises[i] = t->envelopes[noise];
+  sas_envelope_keep (t->noises[i]);
+  t->block_size++;
+
+  return 1;
+}
+
+static int
+read_partials (sas_trace_t t, sas_synthesizer_t s)
+{
+  LONG source;
+  LONG n;
+  struct sas_position_s pos;
+  double * values;
+  int i;
+
+  if ((!IO_Read_BE_LONG (&source, t->fp)) ||
+      (source < 0) || (source >= t->number_of_sources) ||
+      (t->sources[source] == NULL) ||
+      (!IO_Read_BE_LONG (&n, t->fp)) ||
+      (n < 0) ||
+      (!read_position (t, &pos)))
+    return 0;
+
+  values = (double *) malloc ((2 * n + 1) * sizeof (double));
+  assert (values);
+
+  /* Frequencies first, then amplitudes. */
+  for (i = 0; i < n; i++)
+    if ((!read_double (t, values + i)) ||
+	(!read_double (t, values + n + i)))
+      {
+	free (values);
+	return 0;
+      }
+
+  sas_synthesizer_source_set_partials (s, t->sources[source], n,
+				       values, values + n, &pos);
+  free (values);
+
+  return 1;
+}
+
+int
+sas_trace_replay (sas_trace_t t, sas_synthesizer_t s)
+{
+  ULONG id;
+  int i;
+
+  assert (t && !t->recording);
+  assert (s);
+
+  t->block_size = 0;
+
+  for (;;)
+    {
+      int ok;
+
+      if (!IO_Read_BE_ULONG (&id, t->fp))
+	{
+	  /* End of the trace. */
+	  id = 0;
+	  break;
+	}
+
+      if (id == MakeID ('B', 'L', 'C', 'K'))
+	break;
+      else if (id == MakeID ('F', 'R', 'A', 'M'))
+	ok = read_frame (t);
+      else if (id == MakeID ('P', 'A', 'R', 'T'))
+	ok = read_partials (t, s);
+      else if (id == MakeID ('E', 'N', 'V', 'L'))
+	ok = read_envelope (t);
+      else if (id == MakeID ('M', 'A', 'K', 'E'))
+	ok = read_make (t, s);
+      else if (id == MakeID ('F', 'R', 'E', 'E'))
+	ok = read_free (t, s);
+      else
+	ok = 0;
+
+      if (!ok)
+	{
+	  REPORT (fprintf (stderr, "sas_trace_replay: corrupted trace.\n"));
+	  id = 0;
+	  break;
+	}
+    }
+
+  if (id == MakeID ('B', 'L', 'C', 'K'))
+    sas_synthesizer_bulk_update (s, t->block_size, t->block_sources,
+				 t->amplitudes, t->frequencies,
+				 t->colors, t->warps, t->noises,
+				 t->positions);
+
+  for (i = 0; i < t->block_size; i++)
+    {
+      sas_envelope_free (t->colors[i]);
+      sas_envelope_free (t->warps[i]);
+      sas_envelope_free (t->noises[i]);
+    }
+
+  return id == MakeID ('B', 'L', 'C', 'K');
+}
@@ -0,0 +1,92 @@
+/* libsas - library for Structured Additive Synthesis
+   Copyright (C) 1999-2001 Sylvain Marchand
+   Copyright (C) 2001-2002 SCRIME, universit Bordeaux 1
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __SAS_TRACE_H__
+#define __SAS_TRACE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "sas_frame.h"
+#include "sas_synthesizer.h"
+
+/* Abstract data type for traces, that is binary files recording the
+   input of a synthesizer: the creation and deletion of its sources,
+   and the frame (or explicit partials) and position of each source at
+   each block.  A trace
+   recorded from a live session can be replayed into a fresh
+   synthesizer, to run the same synthesis again offline (for
+   benchmarks or profiling).
+
+   The settings of the synthesizer (interpolation mode, harmonic
+   locking, etc.) are not recorded: the synthesizer that replays a
+   trace should be given the same settings as the recorded one. */
+typedef struct sas_trace_s * sas_trace_t;
+
+/* Creates (or truncates) a trace file, for recording.  Returns NULL
+   on failure.  When libsas is compiled with _REENTRANT, the records
+   written during synthesis go into a preallocated ring, and a thread
+   of the trace writes them to the file, so that recording does not
+   block the synthesis (unless the file cannot keep up).  Otherwise,
+   they are written to the file during synthesis, and recording is
+   not real-time safe. */
+extern sas_trace_t sas_trace_create (const char * filename);
+
+/* Opens a trace file, for replay.  Returns NULL on failure. */
+extern sas_trace_t sas_trace_open (const char * filename);
+
+/* Closes a trace.  A trace being recorded should not be used by a
+   synthesizer anymore (see sas_synthesizer_record).  The sources made
+   by sas_trace_replay stay in their synthesizer. */
+extern void sas_trace_close (sas_trace_t t);
+
+/* Starts recording the input of a synthesizer into a trace created
+   by sas_trace_create, from the next block on.  The sources already
+   in the synthesizer are recorded as made at that time.  A NULL trace
+   stops the recording. */
+extern void sas_synthesizer_record (sas_synthesizer_t s, sas_trace_t t);
+
+/* Reads the next block of a trace opened by sas_trace_open, and
+   gives it to 's': sources are made and deleted as they were when
+   recording, and the recorded frames and positions are pushed with
+   sas_synthesizer_bulk_update (explicit partials with
+   sas_synthesizer_source_set_partials).  The caller then synthesizes the
+   block.  The same synthesizer should be given to all the calls.
+   Returns 1 if a block was read, 0 at the end of the trace or if the
+   trace is corrupted. */
+extern int sas_trace_replay (sas_trace_t t, sas_synthesizer_t s);
+
+/* Used by the synthesizer while recording (see
+   sas_synthesizer_record).  Sources are given by number. */
+extern void sas_trace_write_make (sas_trace_t t, int source,
+				  sas_position_t pos);
+extern void sas_trace_write_free (sas_trace_t t, int source);
+extern void sas_trace_write_frame (sas_trace_t t, int source,
+				   sas_frame_t frame, sas_position_t pos);
+extern void sas_trace_write_partials (sas_trace_t t, int source, int n,
+				      double * frequencies,
+				      double * amplitudes,
+				      sas_position_t pos);
+extern void sas_trace_write_block (sas_trace_t t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -22,10 +22,11 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <assert.h>
-#include <sys/time.h>
 #include <unistd.h>
 
-/* Not thread safe. */
+/* Not thread safe: a skip list should be used by one thread at a
+   time.  Different skip lists can be used concurrently (the state of
+   the random level generator is kept in each list). */
 
 typedef int (* compare_fun_t) (const void * e1, const void * e2);
 
@@ -55,6 +56,10 @@ struct skip_list_s {
   void * cell_pool;
   off_t cell_pool_top;
   off_t initial_cell_pool_top;
+  /* State of the random level generator (see random_level). */
+  unsigned long random_state;
+  unsigned long random_bits;
+  unsigned int bits_left;
 };
 
 static inline skip_list_cell_t
@@ -70,6 +75,7 @@ skip_list_cell_make (skip_list_t sl, int level, void * data)
 
   if (sl->cell_pool_top >= SIZEOF_POOL)
     {
+      SAS_RT_EVENT (SAS_RT_EXIT);
       fprintf (stderr, "fatal: size of pool of skip list cells exceeded.\n");
       exit (EXIT_FAILURE);
     }
@@ -85,10 +91,19 @@ skip_list_cell_free (skip_list_t sl, skip_list_cell_t slc)
 {
 }
 
+/* Restarts the random level generator from 'seed' (see
+   sas_random, libsas specific). */
+static inline void
+skip_list_seed (skip_list_t sl, unsigned long seed)
+{
+  sl->random_state = (seed != 0) ? seed : 1;
+  sl->random_bits = 0;
+  sl->bits_left = 0;
+}
+
 static inline skip_list_t
-skip_list_make (compare_fun_t compare)
+skip_list_make (compare_fun_t compare, unsigned long seed)
 {
-  struct timeval tv;
   skip_list_t sl;
   int i;
 
@@ -117,9 +132,7 @@ skip_list_make (compare_fun_t compare)
 
   sl->NIL->prev = sl->header;
 
-  /* Changing random seed. */
-  gettimeofday (&tv, NULL);
-  srandom (tv.tv_sec);
+  skip_list_seed (sl, seed);
 
   return sl;
 }
@@ -199,11 +212,8 @@ skip_list_search (skip_list_t sl, void * data)
 }
 
 static inline int
-random_level (void)
+random_level (skip_list_t sl)
 {
-  static unsigned int random_bits = 0;
-  static unsigned int bits_left = 0;
-
   register int level;
   register int b;
 
@@ -211,19 +221,19 @@ random_level (void)
 
   do
     {
-      if (bits_left == 0)
+      if (sl->bits_left == 0)
 	{
-	  random_bits = random ();
-	  bits_left = sizeof (random_bits);
+	  sl->random_bits = sas_random (&sl->random_state);
+	  sl->bits_left = 32;
 	};
 
-      b = random_bits & 1;
+      b = sl->random_bits & 1;
 
       if (!b)
 	level++;
 
-      random_bits >>= 1;
-      bits_left--;
+      sl->random_bits >>= 1;
+      sl->bits_left--;
     }
   while (!b);
 
@@ -243,7 +253,7 @@ skip_list_insert (skip_list_t sl, void * data)
        return. */
     ;
 
-  level = random_level ();
+  level = random_level (sl);
 
   if (sl->level < level)
     {
@@ -1,6 +1,7 @@
 // include flext header
 #include <flext/flext.h>
 #include <iostream>
+#include <algorithm>
 
 // check for appropriate flext version
 #if !defined(FLEXT_VERSION) || (FLEXT_VERSION < 401)
@@ -9,11 +10,24 @@
 
 
 #include <fts.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include "sas/sas.h"
 
 #define ENVELOPE_SIZE 20
 #define ENVELOPE_BASE (SAS_MAX_AUDIBLE_FREQUENCY / ENVELOPE_SIZE)
 
+// pipelined mode: maximal number of blocks rendered ahead, and
+// number of parameter changes that can wait for the render thread
+#define MAX_LOOKAHEAD 8
+#define PARAMETER_QUEUE_SIZE 8
+
+// partial tap: maximal number of partials output per block, and
+// number of values per partial (frequency, amplitude, left and right
+// gains, masked flag)
+#define MAX_TAP_PARTIALS 128
+#define TAP_VALUES 5
+
 struct source_data_s {
   sas_source_t source;
   char * filename;
@@ -36,6 +50,37 @@ update_callback (sas_synthesizer_t s,
   *pos = &sd->pos;
 }
 
+// everything the synthesis depends on, as set by the messages
+struct parameters_s {
+  double amp;
+  double freq;
+  sas_envelope_t color;
+  sas_envelope_t warp;
+  sas_envelope_t noise;
+  int lowLatency;
+  int harmonic;
+  int groups;
+  int incrementalMasking;
+};
+
+// the partials heard in a block, copied out of the synthesizer (see
+// sas_synthesizer_tap) since the view is only valid until the next
+// block
+struct tap_s {
+  int n;
+  float values[MAX_TAP_PARTIALS*TAP_VALUES];
+};
+
+// orders partials by decreasing amplitudes in the last block
+struct louder_partial_s {
+  sas_synthesizer_t synth;
+  bool operator() (sas_partial_t a, sas_partial_t b) const
+  {
+    return sas_partial_get_amplitude (synth, a) >
+      sas_partial_get_amplitude (synth, b);
+  }
+};
+
 using namespace std;
 
 class sas : public flext_dsp
@@ -48,37 +93,42 @@ public:
 		//create sas synth and frame
 		m_synth = sas_synthesizer_make ();
 
-		m_amp=0.5;
-		m_freq=440;	
+		m_params.amp=0.5;
+		m_params.freq=440;	
+		m_params.lowLatency=0;
+		m_params.harmonic=0;
+		m_params.groups=0;
+		m_params.incrementalMasking=0;
+		m_settingsChanged=false;
+		m_paramsChanged=false;
 
 		for (int i = 0; i < ENVELOPE_SIZE; i++) {
 			m_color[i] = 1.0;
 		}
-		m_colorEnvelope = sas_envelope_make(ENVELOPE_BASE, ENVELOPE_SIZE, m_color);
-		sas_envelope_adjust_for_color (m_colorEnvelope);
+		// m_params holds its own references to its envelopes (see
+		// holdEnvelope)
+		m_params.color = sas_envelope_make(ENVELOPE_BASE, ENVELOPE_SIZE, m_color);
+		sas_envelope_adjust_for_color (m_params.color);
+		sas_envelope_keep (m_params.color);
 
 		for (int i = 0; i < ENVELOPE_SIZE; i++) {
 			m_warp[i]=ENVELOPE_BASE*float(i+1);
 			m_warpIdentity[i]=ENVELOPE_BASE*float(i+1);
 		}
-		m_warpEnvelope = sas_envelope_make(ENVELOPE_BASE, ENVELOPE_SIZE, m_warp);
-		sas_envelope_adjust_for_warp (m_warpEnvelope);
+		// the identity warp lets the synthesizer lock harmonics
+		m_params.warp = sas_envelope_warp_identity();
+		sas_envelope_keep (m_params.warp);
+		// no noise until a "noise" message
+		m_params.noise = sas_envelope_color_0();
+		sas_envelope_keep (m_params.noise);
 		
 
 		m_sourceData.frame = sas_frame_make ();
-		sas_frame_set_amplitude (m_sourceData.frame, m_amp);
-		sas_frame_set_frequency (m_sourceData.frame, m_freq);
-		sas_frame_set_color (m_sourceData.frame, m_colorEnvelope);
-		sas_frame_set_warp (m_sourceData.frame, m_warpEnvelope);
+		applyParameters (m_params);
 		m_sourceData.pos.x = m_sourceData.pos.y = m_sourceData.pos.z = 0.0;
 		
 		m_sourceData.source = sas_synthesizer_source_make (m_synth, &m_sourceData.pos, update_callback, &m_sourceData);
 
-
-		sas_synthesizer_synthesize (m_synth, m_outputBuffer);
-
-		m_counter=0;
-
 		AddInSignal("audio in");
 		AddInFloat("amplitude");
 		AddInFloat("frequency");
@@ -86,19 +136,42 @@ public:
 		AddInAnything("warping (spectral envelope");
 		AddOutSignal("audio out L");
 		AddOutSignal("audio out R");
+		AddOutList("partials of each block (frequency amplitude left right masked)");
 
 		FLEXT_ADDMETHOD(1, setAmp);
 		FLEXT_ADDMETHOD(2, setFreq);
 		FLEXT_ADDMETHOD(3, setColor);
 		FLEXT_ADDMETHOD(4, setWarping);
+		FLEXT_ADDMETHOD_(0, "lowlatency", setLowLatency);
+		FLEXT_ADDMETHOD_(0, "harmonic", setHarmonic);
+		FLEXT_ADDMETHOD_(0, "groups", setGroups);
+		FLEXT_ADDMETHOD_(0, "incrementalmasking", setIncrementalMasking);
+		FLEXT_ADDMETHOD_(0, "lookahead", setLookahead);
+		FLEXT_ADDMETHOD_(0, "noise", setNoise);
+		FLEXT_ADDMETHOD_(0, "hrtf", setHrtf);
+		FLEXT_ADDMETHOD_(0, "tap", setTap);
+
+		m_hrtf=NULL;
+		m_tap=0;
+		m_lookahead=0;
+		m_paramHead=m_paramTail=0;
+		sem_init (&m_renderSemaphore, 0, 0);
 		
 		post("sas~ : structured additive synthesis \n created with flext \n using libsas by Sylvain Marchand and Anthony Beurive \n at SCRIME, University of Bordeaux");
 	}
 
 	~sas()
 	{
+		stopRenderThread ();
+		sem_destroy (&m_renderSemaphore);
 		sas_synthesizer_free (m_synth);
 		sas_frame_free (m_sourceData.frame);
+		sas_envelope_free (m_params.color);
+		sas_envelope_free (m_params.warp);
+		sas_envelope_free (m_params.noise);
+		if(m_hrtf!=NULL) {
+			sas_hrtf_free (m_hrtf);
+		}
 	}
 
 protected:
@@ -111,13 +184,216 @@ private:
 	FLEXT_CALLBACK_F(setAmp)
 	void setAmp(float amp)
 	{
-		m_amp = amp;
+		m_params.amp = amp;
+		m_paramsChanged = true;
 	}
 
 	FLEXT_CALLBACK_F(setFreq)
 	void setFreq(float freq)
 	{
-		m_freq = freq;
+		m_params.freq = freq;
+		m_paramsChanged = true;
+	}
+
+	FLEXT_CALLBACK_I(setLowLatency)
+	void setLowLatency(int on)
+	{
+		m_params.lowLatency = on;
+		m_settingsChanged = true;
+	}
+
+	FLEXT_CALLBACK_I(setHarmonic)
+	void setHarmonic(int on)
+	{
+		m_params.harmonic = on;
+		m_settingsChanged = true;
+	}
+
+	FLEXT_CALLBACK_I(setGroups)
+	void setGroups(int on)
+	{
+		m_params.groups = on;
+		m_settingsChanged = true;
+	}
+
+	FLEXT_CALLBACK_I(setIncrementalMasking)
+	void setIncrementalMasking(int on)
+	{
+		m_params.incrementalMasking = on;
+		m_settingsChanged = true;
+	}
+
+	// 1 outputs the partials of each block on the last outlet, in
+	// time with the audio
+	FLEXT_CALLBACK_I(setTap)
+	void setTap(int on)
+	{
+		__atomic_store_n (&m_tap, on, __ATOMIC_RELEASE);
+	}
+
+	// render thread (or DSP thread): copies the partials of the last
+	// block, the strongest ones if there are too many
+	void captureTap(tap_s & tap)
+	{
+		sas_partial_t * partials;
+		int n = sas_synthesizer_tap (m_synth, &partials);
+		if(n > MAX_TAP_PARTIALS) {
+			louder_partial_s louder = { m_synth };
+			partial_sort (partials, partials + MAX_TAP_PARTIALS,
+				      partials + n, louder);
+			n = MAX_TAP_PARTIALS;
+		}
+		float * v = tap.values;
+		for(int i = 0; i < n; i++) {
+			*v++ = float(sas_partial_get_frequency (m_synth, partials[i]));
+			*v++ = float(sas_partial_get_amplitude (m_synth, partials[i]));
+			*v++ = float(sas_partial_get_left_gain (partials[i]));
+			*v++ = float(sas_partial_get_right_gain (partials[i]));
+			*v++ = float(sas_partial_is_masked (partials[i]));
+		}
+		tap.n = n;
+	}
+
+	// DSP thread: queues the list for the message thread
+	void outputTap(const tap_s & tap)
+	{
+		for(int i = 0; i < tap.n*TAP_VALUES; i++) {
+			SetFloat (m_tapAtoms[i], tap.values[i]);
+		}
+		ToQueueList (2, tap.n*TAP_VALUES, m_tapAtoms);
+	}
+
+	// 0 renders in the DSP thread, n > 0 renders n blocks ahead in a
+	// background thread
+	FLEXT_CALLBACK_I(setLookahead)
+	void setLookahead(int blocks)
+	{
+		if(blocks<0) {
+			blocks=0;
+		}
+		else if(blocks>MAX_LOOKAHEAD) {
+			blocks=MAX_LOOKAHEAD;
+		}
+		stopRenderThread ();
+		m_lookahead = blocks;
+		if(m_lookahead>0) {
+			startRenderThread ();
+		}
+	}
+
+	// sets the frame of the source and the synthesizer settings
+	void applyParameters(const parameters_s & p)
+	{
+		sas_frame_set_amplitude (m_sourceData.frame, p.amp);
+		sas_frame_set_frequency (m_sourceData.frame, p.freq);
+		sas_frame_set_color (m_sourceData.frame, p.color);
+		sas_frame_set_warp (m_sourceData.frame, p.warp);
+		sas_frame_set_noise (m_sourceData.frame, p.noise);
+
+		sas_synthesizer_set_interpolation (m_synth, p.lowLatency ? SAS_INTERPOLATION_LOW_LATENCY : SAS_INTERPOLATION_SMOOTH);
+		sas_synthesizer_set_harmonic_locking (m_synth, p.harmonic);
+		sas_synthesizer_set_harmonic_groups (m_synth, p.groups);
+		sas_synthesizer_set_incremental_masking (m_synth, p.incrementalMasking);
+	}
+
+	// DSP thread: hands the current parameters over to the render
+	// thread.  The queued copy holds its own references to the
+	// envelopes, released by the render thread once applied.
+	void publishParameters()
+	{
+		unsigned int tail = __atomic_load_n (&m_paramTail, __ATOMIC_ACQUIRE);
+		if(m_paramHead - tail >= PARAMETER_QUEUE_SIZE) {
+			// queue full, try again next time
+			return;
+		}
+		parameters_s & p = m_paramQueue[m_paramHead % PARAMETER_QUEUE_SIZE];
+		p = m_params;
+		sas_envelope_keep (p.color);
+		sas_envelope_keep (p.warp);
+		sas_envelope_keep (p.noise);
+		__atomic_store_n (&m_paramHead, m_paramHead + 1, __ATOMIC_RELEASE);
+		m_paramsChanged = false;
+		m_settingsChanged = false;
+	}
+
+	// render thread (or DSP thread once the render thread is stopped)
+	void consumeParameters()
+	{
+		unsigned int head = __atomic_load_n (&m_paramHead, __ATOMIC_ACQUIRE);
+		while(m_paramTail != head) {
+			parameters_s & p = m_paramQueue[m_paramTail % PARAMETER_QUEUE_SIZE];
+			applyParameters (p);
+			sas_envelope_free (p.color);
+			sas_envelope_free (p.warp);
+			sas_envelope_free (p.noise);
+			__atomic_store_n (&m_paramTail, m_paramTail + 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	static void * renderMain(void * data)
+	{
+		((sas *) data)->renderLoop ();
+		return NULL;
+	}
+
+	// renders blocks while there is room in the ring, then waits for
+	// the DSP thread to free a block
+	void renderLoop()
+	{
+		for(;;) {
+			sem_wait (&m_renderSemaphore);
+			if(__atomic_load_n (&m_quit, __ATOMIC_ACQUIRE)) {
+				break;
+			}
+			while(m_head - __atomic_load_n (&m_tail, __ATOMIC_ACQUIRE) < (unsigned int) m_lookahead) {
+				float * block = m_blocks[m_head % m_lookahead];
+				consumeParameters ();
+				sas_synthesizer_render (m_synth, block, block + SAS_SAMPLES, SAS_SAMPLES);
+				if(__atomic_load_n (&m_tap, __ATOMIC_ACQUIRE)) {
+					captureTap (m_taps[m_head % m_lookahead]);
+				}
+				else {
+					m_taps[m_head % m_lookahead].n = -1;
+				}
+				__atomic_store_n (&m_head, m_head + 1, __ATOMIC_RELEASE);
+			}
+		}
+	}
+
+	void startRenderThread()
+	{
+		m_head=m_tail=0;
+		m_position=0;
+		m_quit=0;
+		if(pthread_create (&m_renderThread, NULL, renderMain, this) != 0) {
+			post("sas~ : cannot create render thread, rendering in the DSP thread");
+			m_lookahead=0;
+			return;
+		}
+		sem_post (&m_renderSemaphore);
+	}
+
+	void stopRenderThread()
+	{
+		if(m_lookahead==0) {
+			return;
+		}
+		__atomic_store_n (&m_quit, 1, __ATOMIC_RELEASE);
+		sem_post (&m_renderSemaphore);
+		pthread_join (m_renderThread, NULL);
+		// the DSP thread owns the synthesizer again
+		consumeParameters ();
+		m_lookahead=0;
+	}
+
+	// replaces an envelope of m_params, which keeps a reference to
+	// it until the next replacement: the frame and the parameter
+	// queue hold their own
+	void holdEnvelope(sas_envelope_t & held, sas_envelope_t e)
+	{
+		sas_envelope_keep (e);
+		sas_envelope_free (held);
+		held = e;
 	}
 
 	FLEXT_CALLBACK_A(setColor)
@@ -131,15 +407,19 @@ private:
 					m_color[i]=0;
 				}
 			}
-			m_colorEnvelope = sas_envelope_make(ENVELOPE_BASE, ENVELOPE_SIZE, m_color);
-			sas_envelope_adjust_for_color (m_colorEnvelope);
+			sas_envelope_t color = sas_envelope_make(ENVELOPE_BASE, ENVELOPE_SIZE, m_color);
+			sas_envelope_adjust_for_color (color);
+			holdEnvelope (m_params.color, color);
+			m_paramsChanged = true;
 		}
 		else if(s==sym_bang) {
 			for (int i = 0; i < ENVELOPE_SIZE; i++) {
 				m_color[i] = 1.0;
 			}
-			m_colorEnvelope = sas_envelope_make(ENVELOPE_BASE, ENVELOPE_SIZE, m_color);
-			sas_envelope_adjust_for_color (m_colorEnvelope);
+			sas_envelope_t color = sas_envelope_make(ENVELOPE_BASE, ENVELOPE_SIZE, m_color);
+			sas_envelope_adjust_for_color (color);
+			holdEnvelope (m_params.color, color);
+			m_paramsChanged = true;
 		}
 	}
 
@@ -158,30 +438,109 @@ private:
 				}	
 				m_warp[i]*=m_warpIdentity[i];
 			}
-			m_warpEnvelope = sas_envelope_make(ENVELOPE_BASE, ENVELOPE_SIZE, m_warp);
-			sas_envelope_adjust_for_warp (m_warpEnvelope);
+			sas_envelope_t warp = sas_envelope_make(ENVELOPE_BASE, ENVELOPE_SIZE, m_warp);
+			sas_envelope_adjust_for_warp (warp);
+			holdEnvelope (m_params.warp, warp);
+			m_paramsChanged = true;
 		}
 		else if(s==sym_bang) {
 			for (int i = 0; i < ENVELOPE_SIZE; i++) {
 				m_warp[i]=m_warpIdentity[i];
 			}
-			m_warpEnvelope = sas_envelope_make(ENVELOPE_BASE, ENVELOPE_SIZE, m_warp);
-			sas_envelope_adjust_for_warp (m_warpEnvelope);
+			holdEnvelope (m_params.warp, sas_envelope_warp_identity());
+			m_paramsChanged = true;
+		}
+	}
+
+	// noise envelope, as a list like the color; bang removes the noise
+	FLEXT_CALLBACK_A(setNoise)
+	void setNoise(const t_symbol *s,int argc,t_atom *argv)
+	{
+		if(argc>0) {
+			for (int i = 0; i < ENVELOPE_SIZE; i++) {
+				m_noise[i] = (i<argc) ? double(GetFloat(argv[i])) : 0.0;
+				if(m_noise[i]<0) {
+					m_noise[i]=0;
+				}
+			}
+			sas_envelope_t noise = sas_envelope_make(ENVELOPE_BASE, ENVELOPE_SIZE, m_noise);
+			sas_envelope_adjust_for_color (noise);
+			holdEnvelope (m_params.noise, noise);
+		}
+		else {
+			holdEnvelope (m_params.noise, sas_envelope_color_0());
+		}
+		m_paramsChanged = true;
+	}
+
+	// HRTF set file for binaural rendering; without argument, back to
+	// panning
+	FLEXT_CALLBACK_A(setHrtf)
+	void setHrtf(const t_symbol *s,int argc,t_atom *argv)
+	{
+		sas_hrtf_t hrtf = NULL;
+		if(argc>0) {
+			if(!IsSymbol(argv[0])) {
+				post("sas~ : hrtf expects a file name");
+				return;
+			}
+			hrtf = sas_hrtf_load (GetString(argv[0]));
+			if(hrtf==NULL) {
+				post("sas~ : cannot load HRTF set %s", GetString(argv[0]));
+				return;
+			}
+		}
+		// the render thread may be using the old set: swap them while
+		// it is stopped
+		int lookahead = m_lookahead;
+		stopRenderThread ();
+		sas_synthesizer_set_hrtf (m_synth, hrtf);
+		if(m_hrtf!=NULL) {
+			sas_hrtf_free (m_hrtf);
+		}
+		m_hrtf = hrtf;
+		if(lookahead>0) {
+			m_lookahead = lookahead;
+			startRenderThread ();
 		}
 	}
 	
-	double m_amp;
-	double m_freq;
+	parameters_s m_params;
+	// parameters changed since last applied (or published)
+	bool m_paramsChanged;
+	bool m_settingsChanged;
 	double m_color[ENVELOPE_SIZE];
 	double m_warp[ENVELOPE_SIZE];
+	double m_noise[ENVELOPE_SIZE];
 	double m_warpIdentity[ENVELOPE_SIZE];
 
 	source_data_s m_sourceData;
 	sas_synthesizer_t m_synth;
-	sas_envelope_t m_warpEnvelope;
-	sas_envelope_t m_colorEnvelope;
-	double m_outputBuffer[2*SAS_SAMPLES];
-	int m_counter;
+	sas_hrtf_t m_hrtf;
+
+	// partial tap: on or off, the partials of each block of the ring
+	// (n = -1 if not captured), or of the last block rendered in the
+	// DSP thread, and the atoms of the list
+	int m_tap;
+	tap_s m_taps[MAX_LOOKAHEAD];
+	tap_s m_directTap;
+	t_atom m_tapAtoms[MAX_TAP_PARTIALS*TAP_VALUES];
+
+	// pipelined mode: ring of m_lookahead planar blocks (left then
+	// right), written by the render thread at m_head and read by the
+	// DSP thread at m_tail, m_position samples into the block
+	int m_lookahead;
+	float m_blocks[MAX_LOOKAHEAD][2*SAS_SAMPLES];
+	unsigned int m_head;
+	unsigned int m_tail;
+	int m_position;
+	pthread_t m_renderThread;
+	sem_t m_renderSemaphore;
+	int m_quit;
+	// parameter changes for the render thread
+	parameters_s m_paramQueue[PARAMETER_QUEUE_SIZE];
+	unsigned int m_paramHead;
+	unsigned int m_paramTail;
 };
 
 // instantiate the class
@@ -189,38 +548,54 @@ FLEXT_NEW_DSP("sas~", sas)
 
 void sas::m_signal(int nbFrames, float *const *in, float *const *out)
 {
-	
-	/*
-	sas_frame_set_amplitude (sd1.frame, m_amp);
-	sas_frame_set_frequency (sd1.frame, m_freq);
-	sas_frame_set_color (sd1.frame, e);
-	*/
-	for(int f=0; f<nbFrames; ++f) {
-		/*
-		out[0][n]=float(outputBuffer[m_counter]);
-		out[1][n]=float(outputBuffer[m_counter+SAS_SAMPLES]);
-		m_counter++;
-		if(m_counter>=SAS_SAMPLES) {
-			sas_synthesizer_synthesize (synth, outputBuffer);
-			m_counter=0;
-		}
-		*/
-
-		out[0][f]=float(m_outputBuffer[m_counter]);
-		m_counter++;
-		out[1][f]=float(m_outputBuffer[m_counter]);
-		m_counter++;
-
-		if(m_counter>=SAS_SAMPLES*2) {
-			sas_frame_set_amplitude (m_sourceData.frame, m_amp);
-			sas_frame_set_frequency (m_sourceData.frame, m_freq);
-			sas_frame_set_color (m_sourceData.frame, m_colorEnvelope);
-			sas_frame_set_warp (m_sourceData.frame, m_warpEnvelope);
-			sas_synthesizer_synthesize (m_synth, m_outputBuffer);
-			m_counter=0;
+	if(m_lookahead==0) {
+		// the synthesizer asks for the frame when it needs a new block
+		if(m_paramsChanged || m_settingsChanged) {
+			applyParameters (m_params);
+			m_paramsChanged = m_settingsChanged = false;
+		}
+		double time = sas_synthesizer_get_time (m_synth);
+		sas_synthesizer_render (m_synth, out[0], out[1], nbFrames);
+		if(m_tap && sas_synthesizer_get_time (m_synth) != time) {
+			// a new block was synthesized
+			captureTap (m_directTap);
+			outputTap (m_directTap);
 		}
+		return;
 	}
-}
-
 
+	if(m_paramsChanged || m_settingsChanged) {
+		publishParameters ();
+	}
 
+	int f = 0;
+	while(f < nbFrames) {
+		if(m_tail == __atomic_load_n (&m_head, __ATOMIC_ACQUIRE)) {
+			// the render thread is late: output silence
+			for(; f < nbFrames; f++) {
+				out[0][f] = out[1][f] = 0.0f;
+			}
+			break;
+		}
+		float * block = m_blocks[m_tail % m_lookahead];
+		if(m_position == 0 && m_taps[m_tail % m_lookahead].n >= 0) {
+			// the block starts being heard
+			outputTap (m_taps[m_tail % m_lookahead]);
+		}
+		int n = nbFrames - f;
+		if(n > SAS_SAMPLES - m_position) {
+			n = SAS_SAMPLES - m_position;
+		}
+		for(int i = 0; i < n; i++) {
+			out[0][f + i] = block[m_position + i];
+			out[1][f + i] = block[SAS_SAMPLES + m_position + i];
+		}
+		f += n;
+		m_position += n;
+		if(m_position == SAS_SAMPLES) {
+			m_position = 0;
+			__atomic_store_n (&m_tail, m_tail + 1, __ATOMIC_RELEASE);
+			sem_post (&m_renderSemaphore);
+		}
+	}
+}
@@ -0,0 +1,416 @@
+/* libsas - library for Structured Additive Synthesis
+   Copyright (C) 1999-2001 Sylvain Marchand
+   Copyright (C) 2001-2002 SCRIME, universit Bordeaux 1
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+/* Accuracy test of libsas.  Seeded random scenarios exercise the fast
+   synthesis paths (coarse steps, chirps, silent partials skipped,
+   low-latency interpolation, harmonic locking and groups), each one
+   being compared with the reference synthesis (see
+   sas_synthesizer_synthesize_reference), and incremental masking is
+   compared with full masking.  The envelope functions are checked
+   against exact values.  Prints one line per check, and exits with
+   status 1 if any check fails. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "sas.h"
+
+#define MAX(x,y) (((y)>(x))?(y):(x))
+
+/* Runs per scenario, each with its own seed. */
+#define SEEDS 8
+/* Sources and blocks of a run. */
+#define SOURCES 8
+#define BLOCKS 50
+/* First blocks of a run left out of the measures: partials are born
+   from silence there, each one within AMPLITUDE_TOLERANCE of its
+   interpolated amplitude, which is inaudible but large with regard to
+   the faint onset.  The harmonics above the first partials allocated
+   to a source are born one block later (see
+   sas_synthesizer_source_reserve). */
+#define WARMUP_BLOCKS 5
+/* Points of the color envelopes. */
+#define COLOR_POINTS 32
+
+/* Tolerances of the synthesizer (see sas_synthesizer.c): audibility
+   floor of a partial, phase drift of a partial over a block, and
+   relative amplitude error of a harmonic in a group. */
+#define MIN_DB (-100.0)
+#define MIN_AMP 1e-5
+#define AMPLITUDE_TOLERANCE MIN_AMP
+#define PHASE_TOLERANCE 1e-3
+#define GROUP_TOLERANCE 1e-2
+
+/* Just noticeable difference in the level of a partial, in dB. */
+#define LEVEL_JND 1.0
+
+/* Error budgets of the scenarios (see set_thresholds). */
+typedef enum {
+  BUDGET_EXACT,
+  BUDGET_PHASE,
+  BUDGET_GROUPS,
+  BUDGET_MASKING
+} budget_t;
+
+typedef struct scenario_s * scenario_t;
+struct scenario_s {
+  const char * name;
+  sas_interpolation_t interpolation;
+  int harmonic_locking;
+  int harmonic_groups;
+  int incremental_masking;
+  /* Glide of the fundamentals over the run, in octaves. */
+  double chirp;
+  /* Depth of the vibrato of the fundamentals (relative). */
+  double vibrato;
+  /* If 1, the odd sources are quiet and close to the even ones, and
+     swell and fade, so that their partials get masked and skipped. */
+  int masked;
+  /* If 1, compared with the same synthesizer without incremental
+     masking instead of the reference synthesis. */
+  int versus_full_masking;
+  budget_t budget;
+};
+
+static struct scenario_s scenarios[] = {
+  /* Steady partials, synthesized by the coarsest steps. */
+  { "coarse steps", SAS_INTERPOLATION_SMOOTH, 0, 0, 0,
+    0.0, 0.0, 0, 0, BUDGET_EXACT },
+  { "chirps", SAS_INTERPOLATION_SMOOTH, 0, 0, 0,
+    2.0, 0.02, 0, 0, BUDGET_PHASE },
+  { "silent skip", SAS_INTERPOLATION_SMOOTH, 0, 0, 0,
+    0.0, 0.01, 1, 0, BUDGET_PHASE },
+  { "low latency", SAS_INTERPOLATION_LOW_LATENCY, 0, 0, 0,
+    0.5, 0.02, 0, 0, BUDGET_PHASE },
+  { "harmonic locking", SAS_INTERPOLATION_SMOOTH, 1, 0, 0,
+    1.0, 0.02, 0, 0, BUDGET_PHASE },
+  { "harmonic groups", SAS_INTERPOLATION_SMOOTH, 1, 1, 0,
+    1.0, 0.02, 0, 0, BUDGET_GROUPS },
+  { "incremental masking", SAS_INTERPOLATION_SMOOTH, 0, 0, 1,
+    0.0, 0.01, 1, 1, BUDGET_MASKING }
+};
+
+#define SCENARIOS ((int) (sizeof (scenarios) / sizeof (scenarios[0])))
+
+/* Sets the thresholds of a budget, for a signal at most at full scale
+   (1.0) measured over BLOCKS - WARMUP_BLOCKS blocks. */
+static void
+set_thresholds (budget_t budget, sas_accuracy_thresholds_t t)
+{
+  double blocks;
+
+  blocks = BLOCKS - WARMUP_BLOCKS;
+
+  switch (budget)
+    {
+    case BUDGET_EXACT:
+      /* Steady partials are linear in amplitude and frequency, which
+	 coarse steps synthesize without approximation: nothing may
+	 show above the audibility floor. */
+      t->min_snr = - MIN_DB;
+      t->max_error = MIN_AMP;
+      t->max_spectral_deviation = 20.0 * log10 (1.0 + MIN_AMP);
+      break;
+    case BUDGET_PHASE:
+      /* Each partial drifts by up to PHASE_TOLERANCE per block, and
+	 the drifts of successive blocks add up as a random walk
+	 against the reference, which keeps its own phases.  Such a
+	 drift is inaudible in itself: the magnitude spectra must stay
+	 within the just noticeable difference. */
+      t->min_snr = -20.0 * log10 (PHASE_TOLERANCE) - 10.0 * log10 (blocks);
+      t->max_error = pow (10.0, -0.05 * t->min_snr);
+      t->max_spectral_deviation = LEVEL_JND;
+      break;
+    case BUDGET_GROUPS:
+      /* Same as above, and harmonics of a group may be off by
+	 GROUP_TOLERANCE in amplitude. */
+      t->min_snr = -10.0 * log10 (blocks * PHASE_TOLERANCE * PHASE_TOLERANCE +
+				  GROUP_TOLERANCE * GROUP_TOLERANCE);
+      t->max_error = pow (10.0, -0.05 * t->min_snr);
+      t->max_spectral_deviation = LEVEL_JND;
+      break;
+    case BUDGET_MASKING:
+      /* Incremental masking keeps the verdicts of partials that moved
+	 by less than its hysteresis, so that the partials synthesized
+	 differ from full masking only near their masks, at least 10
+	 dB under their maskers, and in a few of the critical bands:
+	 30 dB under the whole signal.  The spectra differ in the bins
+	 of those partials by design, and are not compared. */
+      t->min_snr = 30.0;
+      t->max_error = pow (10.0, -0.05 * t->min_snr);
+      t->max_spectral_deviation = HUGE_VAL;
+      break;
+    }
+}
+
+/* Pseudo-random numbers of the test, the same on every platform. */
+static unsigned long random_state;
+
+static double
+random_uniform (double min, double max)
+{
+  random_state = (random_state * 1103515245UL + 12345UL) & 0x7fffffffUL;
+  return min + (max - min) * random_state / 2147483648.0;
+}
+
+/* Returns a color envelope whose points decay geometrically by
+   'decay', as harmonic groups expect. */
+static sas_envelope_t
+geometric_color (double decay)
+{
+  double values[COLOR_POINTS];
+  sas_envelope_t color;
+  int i;
+
+  for (i = 0; i < COLOR_POINTS; i++)
+    values[i] = pow (decay, i);
+
+  color = sas_envelope_make (SAS_MAX_AUDIBLE_FREQUENCY / COLOR_POINTS,
+			     COLOR_POINTS, values);
+  sas_envelope_adjust_for_color (color);
+
+  return color;
+}
+
+/* Makes a synthesizer for a scenario. */
+static sas_synthesizer_t
+make_synthesizer (scenario_t sc, unsigned long seed, int incremental_masking)
+{
+  sas_synthesizer_t s;
+
+  s = sas_synthesizer_make ();
+  sas_synthesizer_set_seed (s, seed);
+  sas_synthesizer_set_interpolation (s, sc->interpolation);
+  sas_synthesizer_set_harmonic_locking (s, sc->harmonic_locking);
+  sas_synthesizer_set_harmonic_groups (s, sc->harmonic_groups);
+  sas_synthesizer_set_incremental_masking (s, incremental_masking);
+
+  return s;
+}
+
+/* Runs a scenario with a seed, and adds its blocks to 'a'. */
+static void
+run_scenario (scenario_t sc, unsigned long seed, sas_accuracy_t a)
+{
+  sas_synthesizer_t s, full;
+  sas_source_t sources[SOURCES];
+  sas_source_t full_sources[SOURCES];
+  sas_envelope_t colors[SOURCES];
+  struct sas_position_s positions[SOURCES];
+  double amplitudes[SOURCES];
+  double frequencies[SOURCES];
+  double f0[SOURCES];
+  double a0[SOURCES];
+  double buffer[2 * SAS_SAMPLES];
+  double reference[2 * SAS_SAMPLES];
+  int i;
+  int b;
+
+  random_state = seed;
+
+  s = make_synthesizer (sc, seed, sc->incremental_masking);
+  full = sc->versus_full_masking ? make_synthesizer (sc, seed, 0) : NULL;
+
+  for (i = 0; i < SOURCES; i++)
+    {
+      if (sc->masked && (i & 1))
+	{
+	  /* Quiet, just above the previous source. */
+	  f0[i] = f0[i - 1] * random_uniform (1.01, 1.05);
+	  a0[i] = 0.01 * a0[i - 1];
+	}
+      else
+	{
+	  f0[i] = random_uniform (60.0, 900.0);
+	  a0[i] = random_uniform (0.05, 0.2);
+	}
+
+      /* Kept until the synthesizers are done with them. */
+      colors[i] = geometric_color (random_uniform (0.5, 0.95));
+      sas_envelope_keep (colors[i]);
+
+      positions[i].x = random_uniform (-1.0, 1.0);
+      positions[i].y = random_uniform (0.5, 2.0);
+      positions[i].z = 0.0;
+      sources[i] = sas_synthesizer_source_make (s, positions + i,
+						 NULL, NULL);
+      if (full != NULL)
+	full_sources[i] = sas_synthesizer_source_make (full, positions + i,
+						       NULL, NULL);
+    }
+
+  for (b = 0; b < BLOCKS; b++)
+    {
+      for (i = 0; i < SOURCES; i++)
+	{
+	  frequencies[i] = f0[i] *
+	    pow (2.0, sc->chirp * b / BLOCKS) *
+	    (1.0 + sc->vibrato * sin (0.3 * b + i));
+
+	  amplitudes[i] = a0[i];
+	  if (sc->masked && (i & 1))
+	    /* From masked to audible and back. */
+	    amplitudes[i] *= 1.0 + 10.0 * (0.5 + 0.5 * sin (0.05 * b + i));
+	}
+
+      sas_synthesizer_bulk_update (s, SOURCES, sources,
+				   amplitudes, frequencies,
+				   (b == 0) ? colors : NULL, NULL, NULL,
+				   (b == 0) ? positions : NULL);
+
+      if (full != NULL)
+	{
+	  sas_synthesizer_bulk_update (full, SOURCES, full_sources,
+				       amplitudes, frequencies,
+				       (b == 0) ? colors : NULL, NULL, NULL,
+				       (b == 0) ? positions : NULL);
+	  sas_synthesizer_synthesize (s, buffer);
+	  sas_synthesizer_synthesize (full, reference);
+	}
+      else
+	sas_synthesizer_synthesize_reference (s, buffer, reference);
+
+      if (b >= WARMUP_BLOCKS)
+	sas_accuracy_add (a, buffer, reference);
+    }
+
+  sas_synthesizer_free (s);
+  if (full != NULL)
+    sas_synthesizer_free (full);
+
+  for (i = 0; i < SOURCES; i++)
+    sas_envelope_free (colors[i]);
+}
+
+/* Prints and returns the result of a check. */
+static int
+report (const char * name, int passed)
+{
+  printf ("%-24s %s\n", name, passed ? "ok" : "FAILED");
+  return passed;
+}
+
+/* Checks the envelope functions against exact values: control points,
+   linear spectra (reproduced exactly by the cubic interpolation), and
+   the standard envelopes.  Returns 1 if they all pass. */
+static int
+check_envelopes (void)
+{
+  double values[COLOR_POINTS];
+  sas_envelope_t e;
+  double base;
+  double error;
+  int i;
+  int passed;
+
+  passed = 1;
+  random_state = 1;
+  base = SAS_MAX_AUDIBLE_FREQUENCY / COLOR_POINTS;
+
+  /* Control points. */
+  for (i = 0; i < COLOR_POINTS; i++)
+    values[i] = random_uniform (0.0, 1.0);
+  e = sas_envelope_make (base, COLOR_POINTS, values);
+  sas_envelope_adjust_for_color (e);
+
+  error = 0.0;
+  for (i = 0; i < COLOR_POINTS; i++)
+    error = MAX (error, fabs (sas_envelope_get_value (e, base * (i + 1)) -
+			      values[i]));
+  sas_envelope_free (e);
+  passed &= report ("envelope points", error < 1e-12);
+
+  /* Linear spectrum, between the first and last points. */
+  for (i = 0; i < COLOR_POINTS; i++)
+    values[i] = 0.25 + 0.5 * i / COLOR_POINTS;
+  e = sas_envelope_make (base, COLOR_POINTS, values);
+  sas_envelope_adjust_for_color (e);
+
+  error = 0.0;
+  for (i = 0; i < 1000; i++)
+    {
+      double f;
+
+      f = random_uniform (2.0 * base, (COLOR_POINTS - 1) * base);
+      error = MAX (error, fabs (sas_envelope_get_value (e, f) -
+				(0.25 + 0.5 * (f / base - 1.0) /
+				 COLOR_POINTS)));
+    }
+  sas_envelope_free (e);
+  passed &= report ("envelope lines", error < 1e-12);
+
+  /* Standard envelopes. */
+  error = 0.0;
+  for (i = 0; i < 1000; i++)
+    {
+      double f;
+
+      f = random_uniform (20.0, SAS_MAX_AUDIBLE_FREQUENCY);
+      error = MAX (error,
+		   fabs (sas_envelope_get_value (sas_envelope_warp_identity (),
+						 f) - f) / f);
+      error = MAX (error,
+		   fabs (sas_envelope_get_value (sas_envelope_color_0 (), f)));
+    }
+  passed &= report ("standard envelopes", error < 1e-12);
+
+  return passed;
+}
+
+int
+main (void)
+{
+  int passed;
+  int i;
+
+  passed = check_envelopes ();
+
+  for (i = 0; i < SCENARIOS; i++)
+    {
+      struct sas_accuracy_s a;
+      struct sas_accuracy_thresholds_s t;
+      unsigned long seed;
+
+#ifdef USE_RESONATOR
+      /* The resonator drifts in phase as soon as frequencies change:
+	 the budgets above are the ones of the phasors. */
+      if (!scenarios[i].versus_full_masking)
+	{
+	  printf ("%-24s skipped (USE_RESONATOR)\n", scenarios[i].name);
+	  continue;
+	}
+#endif
+
+      sas_accuracy_reset (&a);
+
+      for (seed = 1; seed <= SEEDS; seed++)
+	run_scenario (scenarios + i, seed, &a);
+
+      set_thresholds (scenarios[i].budget, &t);
+
+      printf ("%-24s snr %.1f dB (min %.1f), max error %.2g (max %.2g), "
+	      "spectral deviation %.3f dB (max %.3g)\n",
+	      scenarios[i].name, sas_accuracy_snr (&a), t.min_snr,
+	      a.max_error, t.max_error, a.spectral_deviation,
+	      t.max_spectral_deviation);
+      passed &= report (scenarios[i].name, sas_accuracy_check (&a, &t));
+    }
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,137 @@
+/* libsas - library for Structured Additive Synthesis
+   Copyright (C) 1999-2001 Sylvain Marchand
+   Copyright (C) 2001-2002 SCRIME, universit Bordeaux 1
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+
+/* Test of sas_synthesizer_bulk_update.  A source given its color, warp
+   and noise once, and NULL envelopes afterwards, must sound exactly
+   like the same source given its envelopes at every block, including
+   after blocks where it was not updated (frozen), short or longer than
+   the propagation buffer.  Exits with status 1 otherwise. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "sas.h"
+
+#define BLOCKS 1500
+#define SEED 1
+/* Points of the envelopes. */
+#define POINTS 8
+
+/* Returns 1 if no update is given at block 'b'. */
+static int
+frozen (int b)
+{
+  return (b == 10) || (b >= 100 && b < 1200);
+}
+
+int
+main (void)
+{
+  sas_synthesizer_t s[2];
+  sas_source_t sources[2];
+  struct sas_position_s position;
+  sas_envelope_t color, warp, noise;
+  double values[POINTS];
+  double buffers[2][2 * SAS_SAMPLES];
+  double max_error;
+  double energy;
+  int i, b;
+
+  for (i = 0; i < POINTS; i++)
+    values[i] = 1.0 / (i + 1);
+  color = sas_envelope_make (SAS_MAX_AUDIBLE_FREQUENCY / POINTS, POINTS,
+			     values);
+  sas_envelope_adjust_for_color (color);
+  sas_envelope_keep (color);
+
+  for (i = 0; i < POINTS; i++)
+    values[i] = 1.01 * SAS_MAX_AUDIBLE_FREQUENCY * (i + 1) / POINTS;
+  warp = sas_envelope_make (SAS_MAX_AUDIBLE_FREQUENCY / POINTS, POINTS,
+			    values);
+  sas_envelope_adjust_for_warp (warp);
+  sas_envelope_keep (warp);
+
+  for (i = 0; i < POINTS; i++)
+    values[i] = 0.001;
+  noise = sas_envelope_make (SAS_MAX_AUDIBLE_FREQUENCY / POINTS, POINTS,
+			     values);
+  sas_envelope_adjust_for_color (noise);
+  sas_envelope_keep (noise);
+
+  position.x = 0.0;
+  position.y = 1.0;
+  position.z = 0.0;
+
+  for (i = 0; i < 2; i++)
+    {
+      s[i] = sas_synthesizer_make ();
+      sas_synthesizer_set_seed (s[i], SEED);
+      sources[i] = sas_synthesizer_source_make (s[i], &position, NULL, NULL);
+    }
+
+  max_error = 0.0;
+  energy = 0.0;
+
+  for (b = 0; b < BLOCKS; b++)
+    {
+      double amplitude, frequency;
+
+      amplitude = 0.2;
+      frequency = 220.0 * (1.0 + 0.01 * sin (0.1 * b));
+
+      if (!frozen (b))
+	{
+	  /* Envelopes once for the first source, always for the
+	     second one. */
+	  sas_synthesizer_bulk_update (s[0], 1, sources, &amplitude,
+				       &frequency,
+				       (b == 0) ? &color : NULL,
+				       (b == 0) ? &warp : NULL,
+				       (b == 0) ? &noise : NULL,
+				       NULL);
+	  sas_synthesizer_bulk_update (s[1], 1, sources + 1, &amplitude,
+				       &frequency, &color, &warp, &noise,
+				       NULL);
+	}
+
+      sas_synthesizer_synthesize (s[0], buffers[0]);
+      sas_synthesizer_synthesize (s[1], buffers[1]);
+
+      for (i = 0; i < 2 * SAS_SAMPLES; i++)
+	{
+	  double error;
+
+	  error = fabs (buffers[0][i] - buffers[1][i]);
+	  if (error > max_error)
+	    max_error = error;
+	  energy += buffers[1][i] * buffers[1][i];
+	}
+    }
+
+  sas_synthesizer_free (s[0]);
+  sas_synthesizer_free (s[1]);
+  sas_envelope_free (color);
+  sas_envelope_free (warp);
+  sas_envelope_free (noise);
+
+  printf ("bulk update: max error %g, energy %g\n", max_error, energy);
+
+  return (max_error == 0.0 && energy > 0.0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}